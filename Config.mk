@@ -94,10 +94,10 @@
 
          SHADOWD=0 # shadow page cleanup
         MOUNTING=0 # be able to mount multiple file systems
-          GETCWD=0 # getcwd(3) syscall-like functionality
+          GETCWD=1 # getcwd(3) syscall-like functionality
         UPREEMPT=0 # userland preemption
              MTP=0 # multiple kernel threads per process
-           PIPES=0 # pipe(2) functionality
+           PIPES=1 # pipe(2) functionality
 
 # Set the number of terminals that we should be launching.
         NTERMS=3
@@ -20,13 +20,17 @@
 #include "mm/kmalloc.h"
 
 #include "fs/vfs_syscall.h"
+#include "fs/vfs.h"
 #include "fs/vnode.h"
+#include "fs/poll.h"
+#include "fs/aio.h"
 
 #include "test/kshell/kshell.h"
 
 #include "vm/brk.h"
 #include "vm/mmap.h"
 #include "vm/vmmap.h"
+#include "vm/vdso.h"
 
 #include "api/syscall.h"
 #include "api/utsname.h"
@@ -42,61 +46,44 @@ static __attribute__((unused)) void syscall_init(void)
 }
 init_func(syscall_init);
 
-// helper function for error handling
-static int handle_error(int err, void *buf) {
-    page_free(buf);
-    curthr->kt_errno = -err;
-    return -1;
-}
+/* most iovec entries readv(2)/writev(2) accept (their IOV_MAX) */
+#define USER_IOV_MAX 1024
+
+/* most descriptors one poll(2) accepts */
+#define USER_POLL_MAX 1024
+
+/* most calls one batch accepts */
+#define USER_BATCH_MAX 64
+
+/* largest kernel buffer one getdents(2) fills */
+#define USER_GETDENTS_PAGES 4
 
 /*
  * this is one of the few sys_* functions you have to write. be sure to
  * check out the sys_* functions we have provided before trying to write
  * this one.
  *  - copy_from_user() the read_args_t
- *  - page_alloc() a temporary buffer
- *  - call do_read(), and copy_to_user() the read bytes
- *  - page_free() your buffer
+ *  - read straight into the caller's pinned pages (see user_file_rwv())
  *  - return the number of bytes actually read, or if anything goes wrong
  *    set curthr->kt_errno and return -1
  */
 static int sys_read(read_args_t *arg) {
     // NOT_YET_IMPLEMENTED("VM: sys_read");
     read_args_t kern_args;
-    void *temp_buf = NULL;
     int num_bytes_read;
 
-    copy_from_user(&kern_args, arg, sizeof(read_args_t));
-
-//     if ((err = copy_from_user(&kern_args, arg, sizeof(read_args_t))) < 0) {
-//             KASSERT(0==1);
-//         return handle_error(err, temp_buf);
-//     }
-        
-
-        temp_buf = page_alloc();
-//     if ((temp_buf = page_alloc()) == NULL){
-//             KASSERT(0==1);
-//         return handle_error(-ENOMEM, temp_buf);
-//     }
-        
-
-    kern_args.buf = temp_buf;
+    if ((num_bytes_read = copy_from_user(&kern_args, arg, sizeof(read_args_t))) < 0) {
+        curthr->kt_errno = -num_bytes_read;
+        return -1;
+    }
 
-    if ((num_bytes_read =
-             do_read(kern_args.fd, kern_args.buf, kern_args.nbytes)) < 0) {
+    struct iovec iov = { .iov_base = kern_args.buf, .iov_len = kern_args.nbytes };
+    if ((num_bytes_read = user_file_rwv(curproc, kern_args.fd, &iov, 1, -1, 0)) < 0) {
         dbg(DBG_PRINT, "(GRADING3D 3)\n");
-        return handle_error(num_bytes_read, kern_args.buf);
-             }
-        
-copy_to_user(arg->buf, kern_args.buf, num_bytes_read);
-//     if ((err = copy_to_user(arg->buf, kern_args.buf, num_bytes_read)) < 0){
-//             KASSERT(0==1);
-// return handle_error(err, kern_args.buf);
-//     }
-        
-
-    page_free(kern_args.buf);
+        curthr->kt_errno = -num_bytes_read;
+        return -1;
+    }
+
     dbg(DBG_PRINT, "(GRADING3B 1)\n");
     return num_bytes_read;
 }
@@ -108,95 +95,245 @@ static int sys_write(write_args_t *arg) {
     //     NOT_YET_IMPLEMENTED("VM: sys_write");
 
     write_args_t kern_args;
-    void *temp_buf = NULL;
     int num_bytes_write;
 
-copy_from_user(&kern_args, arg, sizeof(write_args_t));
-//     if ((err = copy_from_user(&kern_args, arg, sizeof(write_args_t))) < 0) {
-//             KASSERT(0==1);
-// return handle_error(err, temp_buf);
-//     }
-        
-temp_buf = page_alloc();
-//     if ((temp_buf = page_alloc()) == NULL) {
-//             KASSERT(0==1);
-// return handle_error(-ENOMEM, temp_buf);
-//     }
-        
-
-    kern_args.buf = temp_buf;
-
-copy_from_user(kern_args.buf, arg->buf, arg->nbytes);
-//     if ((err = copy_from_user(kern_args.buf, arg->buf, arg->nbytes)) < 0) {
-//             KASSERT(0==1);
-// return handle_error(err, kern_args.buf);
-//     }
-        
-
-    if ((num_bytes_write =
-             do_write(kern_args.fd, kern_args.buf, kern_args.nbytes)) < 0) {
-                     dbg(DBG_PRINT, "(GRADING3D 4)\n");
-return handle_error(num_bytes_write, kern_args.buf);
-             }
-        
-
-    page_free(kern_args.buf);
+    if ((num_bytes_write = copy_from_user(&kern_args, arg, sizeof(write_args_t))) < 0) {
+        curthr->kt_errno = -num_bytes_write;
+        return -1;
+    }
+
+    struct iovec iov = { .iov_base = kern_args.buf, .iov_len = kern_args.nbytes };
+    if ((num_bytes_write = user_file_rwv(curproc, kern_args.fd, &iov, 1, -1, 1)) < 0) {
+        dbg(DBG_PRINT, "(GRADING3D 4)\n");
+        curthr->kt_errno = -num_bytes_write;
+        return -1;
+    }
+
     dbg(DBG_PRINT, "(GRADING3A)\n");
     return num_bytes_write;
 }
 
 /*
- * This is another tricly sys_* function that you will need to write.
- * It's pretty similar to sys_read(), but you don't need
- * to allocate a whole page, just a single dirent_t. call do_getdent in a
- * loop until you have read getdent_args_t->count bytes (or an error
- * occurs).  You should note that count is the number of bytes in the
- * buffer, not the number of dirents, which means that you'll need to loop
- * a max of something like count / sizeof(dirent_t) times.
+ * readv(2) and writev(2): the iovec array is copied in once and the whole
+ * vector handed to user_file_rwv().
+ */
+static int sys_rwv(rwv_args_t *arg, int write)
+{
+        rwv_args_t kern_args;
+        struct iovec *iov;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(rwv_args_t))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        if (kern_args.iovcnt <= 0 || kern_args.iovcnt > USER_IOV_MAX) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+        if (NULL == (iov = (struct iovec *)kmalloc(kern_args.iovcnt * sizeof(struct iovec)))) {
+                curthr->kt_errno = ENOMEM;
+                return -1;
+        }
+        if ((ret = copy_from_user(iov, kern_args.iov,
+                                  kern_args.iovcnt * sizeof(struct iovec))) >= 0) {
+                ret = user_file_rwv(curproc, kern_args.fd, iov, kern_args.iovcnt, -1, write);
+        }
+        kfree(iov);
+
+        if (ret < 0) {
+                dbg(DBG_PRINT, "(GRADING3D 3)\n");
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
+/*
+ * pread(2) and pwrite(2): read or write at an explicit offset without
+ * touching the file position.
+ */
+static int sys_prw(prw_args_t *arg, int write)
+{
+        prw_args_t kern_args;
+        struct iovec iov;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(prw_args_t))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        if (kern_args.off < 0) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        iov.iov_base = kern_args.buf;
+        iov.iov_len = kern_args.nbytes;
+        if ((ret = user_file_rwv(curproc, kern_args.fd, &iov, 1, kern_args.off, write)) < 0) {
+                dbg(DBG_PRINT, "(GRADING3D 3)\n");
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
+/*
+ * sendfile(2): the optional offset is copied in, and back out once the
+ * transfer is done.
+ */
+static int sys_sendfile(sendfile_args_t *arg)
+{
+        sendfile_args_t kern_args;
+        off_t off;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(sendfile_args_t))) < 0 ||
+            (NULL != kern_args.offset &&
+             (ret = copy_from_user(&off, kern_args.offset, sizeof(off_t))) < 0)) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        ret = do_sendfile(kern_args.out_fd, kern_args.in_fd,
+                          (NULL != kern_args.offset) ? &off : NULL, kern_args.count);
+        if (ret >= 0 && NULL != kern_args.offset) {
+                int err = copy_to_user(kern_args.offset, &off, sizeof(off_t));
+                if (err < 0) {
+                        ret = err;
+                }
+        }
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
+/*
+ * poll(2): the pollfd array is copied in once, and back out with the
+ * revents filled in.
+ */
+static int sys_poll(poll_args_t *arg)
+{
+        poll_args_t kern_args;
+        struct pollfd *fds = NULL;
+        size_t size;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(poll_args_t))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        if (kern_args.nfds > USER_POLL_MAX) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        size = kern_args.nfds * sizeof(struct pollfd);
+        if (size > 0) {
+                if (NULL == (fds = (struct pollfd *)kmalloc(size))) {
+                        curthr->kt_errno = ENOMEM;
+                        return -1;
+                }
+                if ((ret = copy_from_user(fds, kern_args.fds, size)) < 0) {
+                        kfree(fds);
+                        curthr->kt_errno = -ret;
+                        return -1;
+                }
+        }
+
+        ret = do_poll(fds, kern_args.nfds, kern_args.timeout);
+        if (ret >= 0 && size > 0) {
+                int err = copy_to_user(kern_args.fds, fds, size);
+                if (err < 0) {
+                        ret = err;
+                }
+        }
+        if (NULL != fds) {
+                kfree(fds);
+        }
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
+static void *sys_aio_setup(unsigned int entries)
+{
+        void *ret;
+        int err;
+
+        if ((err = do_aio_setup(entries, &ret)) < 0) {
+                curthr->kt_errno = -err;
+                return MAP_FAILED;
+        }
+        return ret;
+}
+
+static void *sys_vdso(void)
+{
+        void *ret;
+        int err;
+
+        if ((err = do_vdso(&ret)) < 0) {
+                curthr->kt_errno = -err;
+                return MAP_FAILED;
+        }
+        return ret;
+}
+
+static int sys_aio_enter(unsigned int min_complete)
+{
+        int ret;
+
+        if ((ret = do_aio_enter(min_complete)) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
+/*
+ * Reads as many directory entries as fit into a kernel buffer with
+ * do_getdents() and copies them out in one go. count is the number of
+ * bytes in the user's buffer, not the number of dirents; at most
+ * USER_GETDENTS_PAGES pages are returned per call.
  */
 static int sys_getdents(getdents_args_t *arg) {
     getdents_args_t kern_args;
     dirent_t *dir_buf;
-    uint32_t num_bytes_read = 0;
-
-copy_from_user(&kern_args, arg, sizeof(getdents_args_t));
-//     if ((err = copy_from_user(&kern_args, arg, sizeof(getdents_args_t))) < 0) {
-//             KASSERT(0==1);
-//         return handle_error(err, NULL);
-//     }
-        
-
-    dir_buf = (dirent_t *)kmalloc(sizeof(dirent_t));
-//     if (dir_buf == NULL){
-//             KASSERT(0==1);
-//         return handle_error(-ENOMEM, NULL);
-//     } 
-
-    while (num_bytes_read < kern_args.count) {
-        int temp_bytes_read = do_getdent(kern_args.fd, dir_buf);
-
-        // Stop reading when do_getdent returns 0
-        if (temp_bytes_read == 0) {
-                dbg(DBG_PRINT, "(GRADING3A)\n");
-            break;
-        }
-
-        if (temp_bytes_read < 0) {
-            kfree(dir_buf);
-            dbg(DBG_PRINT, "(GRADING3D 4)\n");
-            return handle_error(temp_bytes_read, NULL);
-        }
-
-        copy_to_user((char *)kern_args.dirp + num_bytes_read, dir_buf,
-                           sizeof(dirent_t));
-        // if (err < 0) {
-        //     kfree(dir_buf);
-        //     KASSERT(0==1);
-        //     return handle_error(err, NULL);
-        // }
-
-        num_bytes_read += sizeof(dirent_t);
-        dbg(DBG_PRINT, "(GRADING3A)\n");
+    size_t size;
+    int err, num_bytes_read;
+
+    if ((err = copy_from_user(&kern_args, arg, sizeof(getdents_args_t))) < 0) {
+        curthr->kt_errno = -err;
+        return -1;
+    }
+
+    size = MIN(kern_args.count, USER_GETDENTS_PAGES * PAGE_SIZE);
+    size -= size % sizeof(dirent_t);
+    if (0 == size) {
+        curthr->kt_errno = EINVAL;
+        return -1;
+    }
+    if (NULL == (dir_buf = (dirent_t *)kmalloc(size))) {
+        curthr->kt_errno = ENOMEM;
+        return -1;
+    }
+
+    if ((num_bytes_read = do_getdents(kern_args.fd, dir_buf, size)) < 0) {
+        kfree(dir_buf);
+        dbg(DBG_PRINT, "(GRADING3D 4)\n");
+        curthr->kt_errno = -num_bytes_read;
+        return -1;
+    }
+    if (num_bytes_read > 0 &&
+        (err = copy_to_user(kern_args.dirp, dir_buf, num_bytes_read)) < 0) {
+        kfree(dir_buf);
+        curthr->kt_errno = -err;
+        return -1;
     }
 
     kfree(dir_buf);
@@ -545,6 +682,78 @@ static int sys_munmap(munmap_args_t *args)
         return 0;
 }
 
+static int sys_mprotect(mprotect_args_t *args)
+{
+        mprotect_args_t         kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(mprotect_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        err = do_mprotect(kargs.addr, kargs.len, kargs.prot);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_madvise(madvise_args_t *args)
+{
+        madvise_args_t          kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(madvise_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        err = do_madvise(kargs.addr, kargs.len, kargs.advice);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_mincore(mincore_args_t *args)
+{
+        mincore_args_t          kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(mincore_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        err = do_mincore(kargs.addr, kargs.len, kargs.vec);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_msync(msync_args_t *args)
+{
+        msync_args_t            kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(msync_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        err = do_msync(kargs.addr, kargs.len, kargs.flags);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
 static void *sys_mmap(mmap_args_t *arg)
 {
         mmap_args_t             kargs;
@@ -565,6 +774,26 @@ static void *sys_mmap(mmap_args_t *arg)
         return ret;
 }
 
+static void *sys_mremap(mremap_args_t *arg)
+{
+        mremap_args_t           kargs;
+        void                    *ret;
+        int                     err;
+
+        if (copy_from_user(&kargs, arg, sizeof(mremap_args_t)) < 0) {
+                curthr->kt_errno = EFAULT;
+                return MAP_FAILED;
+        }
+
+        err = do_mremap(kargs.old_addr, kargs.old_len, kargs.new_len,
+                        kargs.flags, &ret);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return MAP_FAILED;
+        }
+        return ret;
+}
+
 
 static pid_t sys_waitpid(waitpid_args_t *args)
 {
@@ -602,11 +831,46 @@ static void *sys_brk(void *addr)
         }
 }
 
+static void *sys_brk_populate(void *addr)
+{
+        void *ret;
+        int err;
+
+        if (0 == (err = do_brk_populate(addr, &ret))) {
+                return ret;
+        } else {
+                curthr->kt_errno = -err;
+                return (void *) - 1;
+        }
+}
+
 static void sys_sync(void)
 {
         pframe_clean_all();
 }
 
+static int sys_fsync(int fd)
+{
+        int ret;
+
+        if ((ret = do_fsync(fd)) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_fdatasync(int fd)
+{
+        int ret;
+
+        if ((ret = do_fdatasync(fd)) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return 0;
+}
+
 static void sys_halt(void)
 {
         proc_kill_all();
@@ -645,6 +909,31 @@ static int sys_stat(stat_args_t *arg)
         return 0;
 }
 
+static int sys_fstat(fstat_args_t *arg)
+{
+        fstat_args_t kern_args;
+        struct stat buf;
+        int ret;
+
+        if (copy_from_user(&kern_args, arg, sizeof(kern_args)) < 0) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        ret = do_fstat(kern_args.fd, &buf);
+
+        if (ret == 0) {
+                ret = copy_to_user(kern_args.buf, &buf, sizeof(struct stat));
+        }
+
+        if (ret != 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return 0;
+}
+
+#ifdef __PIPES__
 static int sys_pipe(int arg[2])
 {
         int kern_args[2];
@@ -663,6 +952,48 @@ static int sys_pipe(int arg[2])
 
         return 0;
 }
+#endif
+
+#ifdef __GETCWD__
+/*
+ * Copies the current directory's path to the user's buffer. Paths longer
+ * than a page are not supported. Returns the number of bytes copied,
+ * including the null terminator.
+ */
+static int sys_getcwd(getcwd_args_t *arg)
+{
+        getcwd_args_t kern_args;
+        size_t size;
+        char *buf;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(getcwd_args_t))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        if (0 == kern_args.size) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+        if (NULL == (buf = (char *)page_alloc())) {
+                curthr->kt_errno = ENOMEM;
+                return -1;
+        }
+
+        size = MIN(kern_args.size, PAGE_SIZE);
+        if ((ret = lookup_dirpath(curproc->p_cwd, buf, size)) == 0) {
+                size = strlen(buf) + 1;
+                ret = copy_to_user(kern_args.buf, buf, size);
+        }
+        page_free(buf);
+
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return size;
+}
+#endif
 
 static int sys_uname(struct utsname *arg)
 {
@@ -747,7 +1078,16 @@ static int sys_execve(execve_args_t *args, regs_t *regs)
                         goto cleanup;
         }
 
+        /* aiod must keep out of the address space exec replaces */
+        aio_exec_hold(curproc);
         err = do_execve(kern_filename, kern_argv, kern_envp, regs);
+        if (0 == err) {
+                /* the old pages went with the old address space */
+                aio_exit(curproc);
+                vdso_exec();
+        } else {
+                aio_exec_release(curproc);
+        }
 
         curthr->kt_errno = -err;
 
@@ -802,6 +1142,75 @@ static int sys_kshell(int ttyid)
         return 0;
 }
 
+/*
+ * Runs a user array of (sysnum, args) entries through syscall_dispatch()
+ * under a single trap. The array is copied in once and written back once
+ * with each entry's return value and errno filled in. Stops after the
+ * first entry that fails, unless BATCH_CONTINUE is set, and before any
+ * entry if the thread has been cancelled. Calls that need the trap frame
+ * to themselves (fork, execve) and nested batches fail with EINVAL.
+ * Returns the number of entries run.
+ */
+static int sys_batch(batch_args_t *arg, regs_t *regs)
+{
+        batch_args_t kern_args;
+        batch_entry_t *ents;
+        size_t size;
+        int i, ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(batch_args_t))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        if (kern_args.count < 0 || kern_args.count > USER_BATCH_MAX) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+        if (0 == kern_args.count) {
+                return 0;
+        }
+
+        size = kern_args.count * sizeof(batch_entry_t);
+        if (NULL == (ents = (batch_entry_t *)kmalloc(size))) {
+                curthr->kt_errno = ENOMEM;
+                return -1;
+        }
+        if ((ret = copy_from_user(ents, kern_args.entries, size)) < 0) {
+                kfree(ents);
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        for (i = 0; i < kern_args.count && !curthr->kt_cancelled; i++) {
+                switch (ents[i].be_sysnum) {
+                        case SYS_batch:
+                        case SYS_fork:
+                        case SYS_execve:
+                                curthr->kt_errno = EINVAL;
+                                ents[i].be_ret = -1;
+                                break;
+                        default:
+                                curthr->kt_errno = 0;
+                                ents[i].be_ret = syscall_dispatch(ents[i].be_sysnum,
+                                                                  ents[i].be_args, regs);
+                                break;
+                }
+                ents[i].be_errno = (-1 == ents[i].be_ret) ? curthr->kt_errno : 0;
+                if (0 != ents[i].be_errno && !(kern_args.flags & BATCH_CONTINUE)) {
+                        i++;
+                        break;
+                }
+        }
+
+        ret = copy_to_user(kern_args.entries, ents, i * sizeof(batch_entry_t));
+        kfree(ents);
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return i;
+}
+
 /* Interrupt handler for syscalls */
 static void syscall_handler(regs_t *regs)
 {
@@ -823,8 +1232,15 @@ static void syscall_handler(regs_t *regs)
 
         dbginfo(DBG_VMMAP, vmmap_mapping_info, curproc->p_vmmap);
 
+        /* user space may have set errno in its page */
+        if (NULL != curthr->kt_uerrno)
+                curthr->kt_errno = *curthr->kt_uerrno;
+
         int ret = syscall_dispatch(sysnum, args, regs);
 
+        if (NULL != curthr->kt_uerrno)
+                *curthr->kt_uerrno = curthr->kt_errno;
+
         if (curthr->kt_cancelled) {
                 dbg(DBG_SYSCALL, "trap: CANCELLING: thread %p of proc %d "
                     "(%p)\n", curthr, curproc->p_pid, curproc);
@@ -868,6 +1284,12 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                         sys_sync();
                         return 0;
 
+                case SYS_fsync:
+                        return sys_fsync((int)args);
+
+                case SYS_fdatasync:
+                        return sys_fdatasync((int)args);
+
 #ifdef __MOUNTING__
                 case SYS_mount:
                         return sys_mount((mount_args_t *) args);
@@ -882,6 +1304,21 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_munmap:
                         return sys_munmap((munmap_args_t *) args);
 
+                case SYS_mprotect:
+                        return sys_mprotect((mprotect_args_t *) args);
+
+                case SYS_mremap:
+                        return (int) sys_mremap((mremap_args_t *) args);
+
+                case SYS_madvise:
+                        return sys_madvise((madvise_args_t *) args);
+
+                case SYS_mincore:
+                        return sys_mincore((mincore_args_t *) args);
+
+                case SYS_msync:
+                        return sys_msync((msync_args_t *) args);
+
                 case SYS_open:
                         return sys_open((open_args_t *) args);
 
@@ -894,6 +1331,33 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_write:
                         return sys_write((write_args_t *)args);
 
+                case SYS_readv:
+                        return sys_rwv((rwv_args_t *)args, 0);
+
+                case SYS_writev:
+                        return sys_rwv((rwv_args_t *)args, 1);
+
+                case SYS_pread:
+                        return sys_prw((prw_args_t *)args, 0);
+
+                case SYS_pwrite:
+                        return sys_prw((prw_args_t *)args, 1);
+
+                case SYS_sendfile:
+                        return sys_sendfile((sendfile_args_t *)args);
+
+                case SYS_poll:
+                        return sys_poll((poll_args_t *)args);
+
+                case SYS_aio_setup:
+                        return (int) sys_aio_setup((unsigned int)args);
+
+                case SYS_aio_enter:
+                        return sys_aio_enter((unsigned int)args);
+
+                case SYS_vdso:
+                        return (int) sys_vdso();
+
                 case SYS_dup:
                         return sys_dup((int)args);
 
@@ -924,6 +1388,9 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_brk:
                         return (int) sys_brk((void *)args);
 
+                case SYS_brk_populate:
+                        return (int) sys_brk_populate((void *)args);
+
                 case SYS_lseek:
                         return sys_lseek((lseek_args_t *)args);
 
@@ -944,8 +1411,18 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_stat:
                         return sys_stat((stat_args_t *)args);
 
+                case SYS_fstat:
+                        return sys_fstat((fstat_args_t *)args);
+
+#ifdef __PIPES__
                 case SYS_pipe:
                         return sys_pipe((int *)args);
+#endif
+
+#ifdef __GETCWD__
+                case SYS_getcwd:
+                        return sys_getcwd((getcwd_args_t *)args);
+#endif
 
                 case SYS_uname:
                         return sys_uname((struct utsname *)args);
@@ -954,6 +1431,8 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                         return sys_debug((argstr_t *)args);
                 case SYS_kshell:
                         return sys_kshell((int)args);
+                case SYS_batch:
+                        return sys_batch((batch_args_t *)args, regs);
                 default:
                         dbg(DBG_ERROR, "ERROR: unknown system call: %d (args: %#08x)\n", sysnum, args);
                         curthr->kt_errno = ENOSYS;
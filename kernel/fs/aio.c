@@ -0,0 +1,522 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/debug.h"
+
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/kmalloc.h"
+
+#include "vm/vmmap.h"
+
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#include "fs/file.h"
+#include "fs/stat.h"
+#include "fs/open.h"
+#include "fs/aio.h"
+#include "fs/vfs_syscall.h"
+
+#include "api/access.h"
+
+/*
+ * Asynchronous I/O through rings shared with user space.
+ *
+ * do_aio_setup() maps a shared anonymous region into the caller: a header
+ * page (aio_ring_t), then the submission ring of aio_sqe_t, then the
+ * completion ring of aio_cqe_t, twice as long. The pages are pinned and
+ * the kernel works on them through their kernel addresses. The process
+ * fills in submissions and moves ar_sq_tail; the kernel moves ar_sq_head
+ * as it takes them, and posts a completion per submission at ar_cq_tail.
+ * The process consumes completions by moving ar_cq_head.
+ *
+ * The operations are run by aiod, a kernel daemon like pageoutd. It
+ * borrows the submitter's files into its own descriptor table for the
+ * length of each operation, so it goes through the usual do_* calls, and
+ * does reads and writes straight into the submitter's pinned pages (see
+ * user_file_rwv()). do_aio_enter() is the only trap: one hands aiod any
+ * number of submissions and can wait for completions. Only regular files
+ * and block devices are served, so no operation keeps aiod waiting on
+ * another process.
+ */
+
+#define AIO_MAX_ENTRIES 256
+#define AIO_BATCH       32      /* submissions run before moving to the next ring */
+
+typedef struct aio_ctx {
+        proc_t         *ax_proc;
+        int             ax_dead;        /* the owner has exited or exec'd */
+        int             ax_held;        /* the owner is in exec */
+        int             ax_queued;      /* on aiod_work */
+        int             ax_busy;        /* aiod is running its submissions */
+        uint32_t        ax_lopage;
+        uint32_t        ax_npages;
+        pframe_t      **ax_pfs;         /* the pinned ring pages */
+        uint32_t        ax_sqents;
+        uint32_t        ax_cqents;
+        ktqueue_t       ax_cqwait;      /* the owner waiting for completions */
+        ktqueue_t       ax_idle;        /* the owner waiting for aiod to let go */
+        list_link_t     ax_link;        /* on aio_ctxs */
+        list_link_t     ax_worklink;    /* on aiod_work */
+} aio_ctx_t;
+
+#define AIO_SQ_OFF       PAGE_SIZE
+#define AIO_CQ_OFF(ctx)  (AIO_SQ_OFF + PAGE_ALIGN_UP((ctx)->ax_sqents * sizeof(aio_sqe_t)))
+
+static list_t aio_ctxs;
+static list_t aiod_work;
+static ktqueue_t aiod_waitq;
+static proc_t *aiod;
+static kthread_t *aiod_thr;
+
+/* The kernel address of byte off of ctx's ring. */
+static void *aio_addr(aio_ctx_t *ctx, uint32_t off)
+{
+        return (char *)ctx->ax_pfs[off / PAGE_SIZE]->pf_addr + off % PAGE_SIZE;
+}
+
+static volatile aio_ring_t *aio_ring(aio_ctx_t *ctx)
+{
+        return (volatile aio_ring_t *)aio_addr(ctx, 0);
+}
+
+static aio_ctx_t *aio_lookup(proc_t *p)
+{
+        aio_ctx_t *ctx;
+
+        list_iterate_begin(&aio_ctxs, ctx, aio_ctx_t, ax_link)
+        {
+                if (ctx->ax_proc == p)
+                {
+                        return ctx;
+                }
+        }
+        list_iterate_end();
+        return NULL;
+}
+
+static void aio_free(aio_ctx_t *ctx)
+{
+        mmobj_t *o;
+        uint32_t i;
+
+        for (i = 0; i < ctx->ax_npages; i++)
+        {
+                o = ctx->ax_pfs[i]->pf_obj;
+                pframe_unpin(ctx->ax_pfs[i]);
+                o->mmo_ops->put(o);
+        }
+        kfree(ctx->ax_pfs);
+        kfree(ctx);
+}
+
+/*
+ * Installs p's file fd in aiod's own table so that the do_* calls can be
+ * used on it. Returns aiod's descriptor, to be given back with do_close().
+ *
+ * Only regular files and block devices are taken (EINVAL otherwise). A
+ * pipe or tty can block aiod for as long as it likes, and aiod is one
+ * thread serving every ring, which aio_exit() also has to wait on.
+ */
+static int aio_borrow(proc_t *p, int fd)
+{
+        file_t *f;
+        int kfd;
+
+        if (fd < 0 || fd >= NFILES || NULL == (f = p->p_files[fd]))
+        {
+                return -EBADF;
+        }
+        if (!S_ISREG(f->f_vnode->vn_mode) && !S_ISBLK(f->f_vnode->vn_mode))
+        {
+                return -EINVAL;
+        }
+        if ((kfd = get_empty_fd(curproc)) < 0)
+        {
+                return kfd;
+        }
+        fref(f);
+        curproc->p_files[kfd] = f;
+        return kfd;
+}
+
+/* Runs one submission on behalf of p and returns its result. */
+static int aio_do(proc_t *p, aio_sqe_t *sqe)
+{
+        struct iovec iov;
+        off_t off = sqe->as_off;
+        int fd, fd2;
+        int ret;
+
+        if (off < -1)
+        {
+                return -EINVAL;
+        }
+        if ((fd = aio_borrow(p, sqe->as_fd)) < 0)
+        {
+                return fd;
+        }
+
+        switch (sqe->as_op)
+        {
+        case AIO_OP_READ:
+        case AIO_OP_WRITE:
+                iov.iov_base = sqe->as_buf;
+                iov.iov_len = sqe->as_len;
+                ret = user_file_rwv(p, fd, &iov, 1, off, AIO_OP_WRITE == sqe->as_op);
+                break;
+        case AIO_OP_FSYNC:
+                ret = do_fsync(fd);
+                break;
+        case AIO_OP_SENDFILE:
+                if ((fd2 = aio_borrow(p, sqe->as_fd2)) < 0)
+                {
+                        ret = fd2;
+                        break;
+                }
+                ret = do_sendfile(fd, fd2, (-1 == off) ? NULL : &off, sqe->as_len);
+                do_close(fd2);
+                break;
+        default:
+                ret = -EINVAL;
+                break;
+        }
+
+        do_close(fd);
+        return ret;
+}
+
+/*
+ * Runs up to AIO_BATCH of ctx's submissions, stopping early when the
+ * completion ring is full. Returns nonzero if there are more to run.
+ */
+static int aio_run(aio_ctx_t *ctx)
+{
+        volatile aio_ring_t *ring;
+        aio_sqe_t sqe;
+        aio_cqe_t *cqe;
+        uint32_t head;
+        int n, res;
+
+        for (n = 0; n < AIO_BATCH; n++)
+        {
+                ring = aio_ring(ctx);
+                head = ring->ar_sq_head;
+                if (ctx->ax_dead || ctx->ax_held || head == ring->ar_sq_tail)
+                {
+                        return 0;
+                }
+                if (ring->ar_cq_tail - ring->ar_cq_head >= ctx->ax_cqents)
+                {
+                        /* picked up again by the next do_aio_enter() */
+                        return 0;
+                }
+
+                /* the process can scribble on the ring at any time; work
+                 * on a copy of the submission */
+                memcpy(&sqe, aio_addr(ctx, AIO_SQ_OFF + (head % ctx->ax_sqents) * sizeof(aio_sqe_t)),
+                       sizeof(aio_sqe_t));
+                ring->ar_sq_head = head + 1;
+
+                res = aio_do(ctx->ax_proc, &sqe);
+
+                ring = aio_ring(ctx);
+                cqe = (aio_cqe_t *)aio_addr(ctx, AIO_CQ_OFF(ctx) +
+                                                     (ring->ar_cq_tail % ctx->ax_cqents) * sizeof(aio_cqe_t));
+                cqe->ac_data = sqe.as_data;
+                cqe->ac_res = res;
+                ring->ar_cq_tail++;
+                sched_wakeup_on(&ctx->ax_cqwait);
+        }
+        return 1;
+}
+
+static void *aiod_run(int arg1, void *arg2)
+{
+        aio_ctx_t *ctx;
+
+        while (1)
+        {
+                while (list_empty(&aiod_work))
+                {
+                        if (sched_cancellable_sleep_on(&aiod_waitq))
+                        {
+                                kthread_exit((void *)0);
+                        }
+                }
+
+                ctx = list_head(&aiod_work, aio_ctx_t, ax_worklink);
+                list_remove(&ctx->ax_worklink);
+                ctx->ax_queued = 0;
+
+                ctx->ax_busy = 1;
+                if (aio_run(ctx) && !ctx->ax_dead)
+                {
+                        /* let the other rings have a turn */
+                        list_insert_tail(&aiod_work, &ctx->ax_worklink);
+                        ctx->ax_queued = 1;
+                }
+                ctx->ax_busy = 0;
+                if (ctx->ax_dead || ctx->ax_held)
+                {
+                        sched_wakeup_on(&ctx->ax_idle);
+                }
+        }
+        return NULL;
+}
+
+static __attribute__((unused)) void aiod_init(void)
+{
+        list_init(&aio_ctxs);
+        list_init(&aiod_work);
+        sched_queue_init(&aiod_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid) && "should be calling this from idleproc");
+        aiod = proc_create("aiod");
+        KASSERT(NULL != aiod);
+        aiod_thr = kthread_create(aiod, aiod_run, 0, NULL);
+        KASSERT(NULL != aiod_thr);
+
+        sched_make_runnable(aiod_thr);
+}
+init_func(aiod_init);
+init_depends(sched_init);
+
+/*
+ * Stops aiod and waits for it, the way pframe_shutdown() does pageoutd,
+ * so that its reference to the root directory is gone before the file
+ * systems are unmounted. Every process with rings has exited by now.
+ */
+void aio_shutdown(void)
+{
+        int pid, child;
+
+        KASSERT(PID_IDLE == curproc->p_pid); /* Should call from idleproc */
+        KASSERT(NULL != aiod_thr);
+        KASSERT(list_empty(&aio_ctxs));
+
+        kthread_cancel(aiod_thr, (void *)0);
+        aiod_thr = NULL;
+
+        pid = aiod->p_pid;
+        child = do_waitpid(pid, 0, NULL);
+        KASSERT(pid == child && "waited on process other than aiod");
+        aiod = NULL;
+}
+
+/*
+ * Sets up the rings for the current process, with entries submission
+ * slots, and returns their address in *ret.
+ *
+ * Error cases:
+ *      o EINVAL
+ *        entries is 0, larger than AIO_MAX_ENTRIES or not a power of two.
+ *      o EBUSY
+ *        The process already has rings.
+ *      o ENOMEM
+ *        There is no room in the address space, or no kernel memory.
+ */
+int do_aio_setup(unsigned int entries, void **ret)
+{
+        vmmap_t *map = curproc->p_vmmap;
+        aio_ctx_t *ctx;
+        volatile aio_ring_t *ring;
+        vmarea_t *vma;
+        uint32_t i;
+        int lopage, err;
+
+        if (0 == entries || entries > AIO_MAX_ENTRIES || (entries & (entries - 1)))
+        {
+                return -EINVAL;
+        }
+        if (NULL != aio_lookup(curproc))
+        {
+                return -EBUSY;
+        }
+        if (NULL == (ctx = (aio_ctx_t *)kmalloc(sizeof(aio_ctx_t))))
+        {
+                return -ENOMEM;
+        }
+        memset(ctx, 0, sizeof(aio_ctx_t));
+        ctx->ax_proc = curproc;
+        ctx->ax_sqents = entries;
+        ctx->ax_cqents = 2 * entries;
+        ctx->ax_npages = ADDR_TO_PN(AIO_CQ_OFF(ctx) +
+                                    PAGE_ALIGN_UP(ctx->ax_cqents * sizeof(aio_cqe_t)));
+        sched_queue_init(&ctx->ax_cqwait);
+        sched_queue_init(&ctx->ax_idle);
+
+        if (NULL == (ctx->ax_pfs = (pframe_t **)kmalloc(ctx->ax_npages * sizeof(pframe_t *))))
+        {
+                kfree(ctx);
+                return -ENOMEM;
+        }
+        if ((lopage = vmmap_find_range(map, ctx->ax_npages, VMMAP_DIR_HILO)) < 0)
+        {
+                err = -ENOMEM;
+                goto fail;
+        }
+        ctx->ax_lopage = lopage;
+        if ((err = vmmap_map(map, NULL, ctx->ax_lopage, ctx->ax_npages, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANON, 0, VMMAP_DIR_HILO, &vma)) < 0)
+        {
+                goto fail;
+        }
+        if ((err = vmmap_pin_pages(map, ctx->ax_lopage, ctx->ax_npages, 1, ctx->ax_pfs)) < 0)
+        {
+                vmmap_remove(map, ctx->ax_lopage, ctx->ax_npages);
+                goto fail;
+        }
+        /* the pages stay with the rings even if the process unmaps them */
+        for (i = 0; i < ctx->ax_npages; i++)
+        {
+                ctx->ax_pfs[i]->pf_obj->mmo_ops->ref(ctx->ax_pfs[i]->pf_obj);
+        }
+
+        ring = aio_ring(ctx);
+        ring->ar_sq_head = ring->ar_sq_tail = 0;
+        ring->ar_cq_head = ring->ar_cq_tail = 0;
+        ring->ar_sq_entries = ctx->ax_sqents;
+        ring->ar_cq_entries = ctx->ax_cqents;
+        ring->ar_sq_off = AIO_SQ_OFF;
+        ring->ar_cq_off = AIO_CQ_OFF(ctx);
+
+        list_insert_tail(&aio_ctxs, &ctx->ax_link);
+        *ret = PN_TO_ADDR(ctx->ax_lopage);
+        return 0;
+
+fail:
+        kfree(ctx->ax_pfs);
+        kfree(ctx);
+        return err;
+}
+
+/* Puts ctx on aiod's list if it has submissions waiting. */
+static void aio_queue(aio_ctx_t *ctx)
+{
+        volatile aio_ring_t *ring = aio_ring(ctx);
+
+        if (ring->ar_sq_head != ring->ar_sq_tail && !ctx->ax_queued)
+        {
+                list_insert_tail(&aiod_work, &ctx->ax_worklink);
+                ctx->ax_queued = 1;
+                sched_wakeup_on(&aiod_waitq);
+        }
+}
+
+/*
+ * Hands aiod whatever the current process has submitted, then waits until
+ * at least min_complete completions are waiting to be consumed, or until
+ * nothing is left in flight. Returns the number of completions waiting.
+ *
+ * Error cases:
+ *      o EINVAL
+ *        The process has no rings.
+ *      o EINTR
+ *        The wait was cancelled.
+ */
+int do_aio_enter(unsigned int min_complete)
+{
+        aio_ctx_t *ctx;
+        volatile aio_ring_t *ring;
+        int err;
+
+        if (NULL == (ctx = aio_lookup(curproc)))
+        {
+                return -EINVAL;
+        }
+
+        aio_queue(ctx);
+
+        while ((ring = aio_ring(ctx))->ar_cq_tail - ring->ar_cq_head < min_complete)
+        {
+                if (!ctx->ax_queued && !ctx->ax_busy)
+                {
+                        /* nothing more is coming */
+                        break;
+                }
+                if ((err = sched_cancellable_sleep_on(&ctx->ax_cqwait)) < 0)
+                {
+                        return err;
+                }
+        }
+        return ring->ar_cq_tail - ring->ar_cq_head;
+}
+
+/*
+ * Keeps aiod off p's rings while p execs, since exec replaces the address
+ * space aiod works in, and waits for the operation aiod is on to finish.
+ * aio_exec_release() lets it back on if the exec fails; aio_exit() tears
+ * the rings down if it succeeds.
+ */
+void aio_exec_hold(proc_t *p)
+{
+        aio_ctx_t *ctx;
+
+        if (NULL == (ctx = aio_lookup(p)))
+        {
+                return;
+        }
+        ctx->ax_held = 1;
+        if (ctx->ax_queued)
+        {
+                list_remove(&ctx->ax_worklink);
+                ctx->ax_queued = 0;
+        }
+        while (ctx->ax_busy)
+        {
+                sched_sleep_on(&ctx->ax_idle);
+        }
+}
+
+/* Undoes aio_exec_hold() after a failed exec. */
+void aio_exec_release(proc_t *p)
+{
+        aio_ctx_t *ctx;
+
+        if (NULL == (ctx = aio_lookup(p)))
+        {
+                return;
+        }
+        ctx->ax_held = 0;
+        aio_queue(ctx);
+}
+
+/*
+ * Tears down p's rings as p exits or execs, once aiod is done with them.
+ * Called before p's files and address space go away. The wait is bounded:
+ * aiod finishes at most the operation it is on, which is on a regular
+ * file or block device (see aio_borrow()).
+ */
+void aio_exit(proc_t *p)
+{
+        aio_ctx_t *ctx;
+
+        if (NULL == (ctx = aio_lookup(p)))
+        {
+                return;
+        }
+        ctx->ax_dead = 1;
+        list_remove(&ctx->ax_link);
+        if (ctx->ax_queued)
+        {
+                list_remove(&ctx->ax_worklink);
+                ctx->ax_queued = 0;
+        }
+        while (ctx->ax_busy)
+        {
+                sched_sleep_on(&ctx->ax_idle);
+        }
+        aio_free(ctx);
+}
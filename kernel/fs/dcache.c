@@ -0,0 +1,714 @@
+#include "kernel.h"
+#include "globals.h"
+#include "types.h"
+#include "errno.h"
+
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/printf.h"
+#include "util/debug.h"
+
+#include "mm/slab.h"
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+
+#include "fs/dirent.h"
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#include "fs/dcache.h"
+
+/*
+ * The directory entry cache. lookup() asks it before going to the file
+ * system, and tells it what the file system answered, including that a
+ * name does not exist (a negative entry).
+ *
+ * Entries are keyed by the (file system, vnode number) of the directory
+ * and the name, and remember the (file system, vnode number) of the
+ * result rather than the vnode itself. The cache therefore holds no vnode
+ * references: it does not keep deleted files alive or file systems busy,
+ * and a hit costs a vget() instead of a directory scan. In exchange the
+ * callers that change a directory must tell the cache (see
+ * dcache_invalidate() and dcache_purge_dir()).
+ *
+ * At most DCACHE_MAX entries are kept; the least recently used goes first.
+ *
+ * Large directories are indexed instead: the first miss in a directory
+ * longer than DCACHE_INDEX_MINLEN reads the whole directory into the
+ * cache once. Those entries are not on the LRU, and a name with no entry
+ * in a complete index does not exist, so lookups, and the existence
+ * checks of create and link, no longer scan the directory. A name that
+ * changes in an indexed directory is kept as an unknown entry, which the
+ * next lookup of it resolves through the file system. An index may hold
+ * at most DCACHE_INDEX_MAX entries, and fewer when memory is short, as
+ * indexes are not reclaimed under pressure; a directory found to be
+ * bigger than that is remembered and left to the file system until it
+ * shrinks or more memory is free. An index that fills up after it was
+ * built keeps its entries but stops answering misses, rather than being
+ * read again; so does one whose name could not be marked unknown.
+ *
+ * A successful unlink or rmdir leaves a negative entry behind, so that
+ * the name's next lookup or create does not go to the file system. The
+ * unlink and rmdir ops themselves still find the name by scanning the
+ * directory; the cache knows the name but not where it is stored, and
+ * the ops take no hint.
+ *
+ * Positive entries are also hashed by what they resolve to, so the name
+ * of a vnode and the directory it is in can be found without reading any
+ * directory; getcwd walks up the tree that way (see dcache_name()).
+ */
+
+#define DCACHE_NBUCKETS 4096    /* enough for a few indexed directories */
+#define DCACHE_MAX      256
+
+#define DCACHE_NINDEX           8       /* most directories indexed at once */
+#define DCACHE_INDEX_MINLEN     2048    /* bytes of directory worth indexing */
+#define DCACHE_INDEX_MAX        65536   /* most entries in one index */
+#define DCACHE_INDEX_MEMSHARE   16      /* an index may take 1/16 of free memory */
+#define DCACHE_NTOOBIG          8       /* directories remembered as too big */
+
+#define DENT_POSITIVE   0
+#define DENT_NEGATIVE   1
+#define DENT_UNKNOWN    2
+
+typedef struct dir_index {
+        fs_t           *di_fs;          /* the directory */
+        ino_t           di_vno;
+        int             di_building;    /* dcache_index_build() is reading it */
+        int             di_complete;    /* every name in it has an entry */
+        int             di_stale;       /* changed while being read */
+        int             di_count;
+        int             di_limit;       /* most entries it may hold */
+        list_t          di_ents;        /* its dentries */
+        list_link_t     di_link;        /* on dcache_indexes, oldest first */
+} dir_index_t;
+
+typedef struct dentry {
+        fs_t           *d_fs;           /* the directory */
+        ino_t           d_dirvno;
+        char            d_name[NAME_LEN + 1];
+        size_t          d_len;
+        fs_t           *d_childfs;      /* what the name resolves to, */
+        ino_t           d_childvno;     /* if DENT_POSITIVE */
+        int             d_state;
+        dir_index_t    *d_index;        /* NULL if on the LRU */
+        list_link_t     d_hlink;        /* on its hash chain */
+        list_link_t     d_rlink;        /* on its reverse chain, if positive */
+        list_link_t     d_lrulink;      /* on dcache_lru or its index */
+} dentry_t;
+
+static slab_allocator_t *dentry_allocator;
+static list_t dcache_hash[DCACHE_NBUCKETS];
+static list_t dcache_rhash[DCACHE_NBUCKETS];    /* by d_childfs, d_childvno */
+static list_t dcache_lru;
+static int dcache_count;
+static list_t dcache_indexes;
+static int dcache_nindexes;
+
+/* directories which did not fit in an index, most recent last */
+static struct {
+        fs_t           *tb_fs;          /* NULL if unused */
+        ino_t           tb_vno;
+        off_t           tb_len;         /* the directory's length then */
+        int             tb_limit;       /* the index size it outgrew */
+} dcache_toobig[DCACHE_NTOOBIG];
+static int dcache_toobig_next;
+
+static struct {
+        uint32_t        ds_hits;
+        uint32_t        ds_neghits;
+        uint32_t        ds_misses;
+        uint32_t        ds_evictions;
+        uint32_t        ds_invalidations;
+        uint32_t        ds_indexed;
+} dcache_stats;
+
+static __attribute__((unused)) void dcache_init(void)
+{
+        int i;
+
+        dentry_allocator = slab_allocator_create("dentry", sizeof(dentry_t));
+        KASSERT(NULL != dentry_allocator);
+        for (i = 0; i < DCACHE_NBUCKETS; i++)
+        {
+                list_init(&dcache_hash[i]);
+                list_init(&dcache_rhash[i]);
+        }
+        list_init(&dcache_lru);
+        list_init(&dcache_indexes);
+}
+init_func(dcache_init);
+
+static list_t *dcache_bucket(fs_t *fs, ino_t dirvno, const char *name, size_t len)
+{
+        uint32_t h = (uint32_t)fs * 31 + (uint32_t)dirvno;
+        size_t i;
+
+        for (i = 0; i < len; i++)
+        {
+                h = h * 31 + (unsigned char)name[i];
+        }
+        return &dcache_hash[h % DCACHE_NBUCKETS];
+}
+
+static list_t *dcache_rbucket(fs_t *fs, ino_t vno)
+{
+        return &dcache_rhash[((uint32_t)fs * 31 + (uint32_t)vno) % DCACHE_NBUCKETS];
+}
+
+static dentry_t *dcache_find(vnode_t *dir, const char *name, size_t len)
+{
+        list_t *bucket = dcache_bucket(dir->vn_fs, dir->vn_vno, name, len);
+        dentry_t *d;
+
+        list_iterate_begin(bucket, d, dentry_t, d_hlink)
+        {
+                if (d->d_fs == dir->vn_fs && d->d_dirvno == dir->vn_vno &&
+                    d->d_len == len && 0 == strncmp(d->d_name, name, len))
+                {
+                        return d;
+                }
+        }
+        list_iterate_end();
+        return NULL;
+}
+
+/* Says what d resolves to, keeping the reverse hash up to date. */
+static void dcache_set(dentry_t *d, int state, fs_t *childfs, ino_t childvno)
+{
+        if (list_link_is_linked(&d->d_rlink))
+        {
+                list_remove(&d->d_rlink);
+        }
+        d->d_state = state;
+        d->d_childfs = childfs;
+        d->d_childvno = childvno;
+        /* "." and ".." are not what a directory is called */
+        if (DENT_POSITIVE == state && 0 != strcmp(d->d_name, ".") &&
+            0 != strcmp(d->d_name, ".."))
+        {
+                list_insert_tail(dcache_rbucket(childfs, childvno), &d->d_rlink);
+        }
+}
+
+static void dcache_drop(dentry_t *d)
+{
+        list_remove(&d->d_hlink);
+        if (list_link_is_linked(&d->d_rlink))
+        {
+                list_remove(&d->d_rlink);
+        }
+        list_remove(&d->d_lrulink);
+        if (NULL != d->d_index)
+        {
+                d->d_index->di_count--;
+        }
+        else
+        {
+                dcache_count--;
+        }
+        slab_obj_free(dentry_allocator, d);
+}
+
+static dir_index_t *dcache_index_find(fs_t *fs, ino_t vno)
+{
+        dir_index_t *di;
+
+        list_iterate_begin(&dcache_indexes, di, dir_index_t, di_link)
+        {
+                if (di->di_fs == fs && di->di_vno == vno)
+                {
+                        return di;
+                }
+        }
+        list_iterate_end();
+        return NULL;
+}
+
+/* Forgets an index and every entry in it. */
+static void dcache_index_drop(dir_index_t *di)
+{
+        dentry_t *d;
+
+        list_iterate_begin(&di->di_ents, d, dentry_t, d_lrulink)
+        {
+                dcache_drop(d);
+        }
+        list_iterate_end();
+        list_remove(&di->di_link);
+        dcache_nindexes--;
+        kfree(di);
+}
+
+/* Moves d onto di, or onto the LRU if di is NULL. */
+static void dcache_place(dentry_t *d, dir_index_t *di)
+{
+        if (list_link_is_linked(&d->d_lrulink))
+        {
+                list_remove(&d->d_lrulink);
+                if (NULL != d->d_index)
+                {
+                        d->d_index->di_count--;
+                }
+                else
+                {
+                        dcache_count--;
+                }
+        }
+        d->d_index = di;
+        if (NULL != di)
+        {
+                list_insert_tail(&di->di_ents, &d->d_lrulink);
+                di->di_count++;
+        }
+        else
+        {
+                list_insert_tail(&dcache_lru, &d->d_lrulink);
+                dcache_count++;
+        }
+}
+
+/*
+ * Finds or makes the entry for name in dir, on dir's index if it has one.
+ * Returns NULL if there is no memory.
+ */
+static dentry_t *dcache_get(vnode_t *dir, const char *name, size_t len)
+{
+        dir_index_t *di = dcache_index_find(dir->vn_fs, dir->vn_vno);
+        dentry_t *d;
+
+        if (NULL != (d = dcache_find(dir, name, len)))
+        {
+                if (NULL == d->d_index && (NULL == di || di->di_count < di->di_limit))
+                {
+                        dcache_place(d, di);
+                }
+                return d;
+        }
+
+        if (NULL != di && di->di_count >= di->di_limit)
+        {
+                /* an index being built is dropped by its builder; a built
+                 * one keeps its entries, but a miss is no longer final */
+                if (di->di_building)
+                {
+                        di->di_stale = 1;
+                }
+                di->di_complete = 0;
+                di = NULL;
+        }
+        if (NULL == di && dcache_count >= DCACHE_MAX)
+        {
+                dcache_drop(list_head(&dcache_lru, dentry_t, d_lrulink));
+                dcache_stats.ds_evictions++;
+        }
+        if (NULL == (d = (dentry_t *)slab_obj_alloc(dentry_allocator)))
+        {
+                return NULL;
+        }
+        d->d_fs = dir->vn_fs;
+        d->d_dirvno = dir->vn_vno;
+        memcpy(d->d_name, name, len);
+        d->d_name[len] = '\0';
+        d->d_len = len;
+        d->d_state = DENT_UNKNOWN;
+        d->d_childfs = NULL;
+        d->d_childvno = 0;
+        d->d_index = NULL;
+        list_link_init(&d->d_lrulink);
+        list_link_init(&d->d_rlink);
+        list_insert_tail(dcache_bucket(d->d_fs, d->d_dirvno, name, len), &d->d_hlink);
+        dcache_place(d, di);
+        return d;
+}
+
+/*
+ * The most entries a new index may hold: DCACHE_INDEX_MAX, or fewer if
+ * that would take more than a share of free memory.
+ */
+static int dcache_index_limit(void)
+{
+        uint32_t budget = page_free_count() * PAGE_SIZE / DCACHE_INDEX_MEMSHARE /
+                          sizeof(dentry_t);
+
+        return (int)MIN(budget, DCACHE_INDEX_MAX);
+}
+
+/*
+ * Whether dir was too big to index last time and still is: it has not
+ * shrunk and indexes may not be any bigger now.
+ */
+static int dcache_toobig_find(vnode_t *dir)
+{
+        int i;
+
+        for (i = 0; i < DCACHE_NTOOBIG; i++)
+        {
+                if (dcache_toobig[i].tb_fs == dir->vn_fs &&
+                    dcache_toobig[i].tb_vno == dir->vn_vno)
+                {
+                        if (dir->vn_len >= dcache_toobig[i].tb_len &&
+                            dcache_index_limit() <= dcache_toobig[i].tb_limit)
+                        {
+                                return 1;
+                        }
+                        dcache_toobig[i].tb_fs = NULL;
+                        return 0;
+                }
+        }
+        return 0;
+}
+
+/* Remembers that dir did not fit in an index of limit entries. */
+static void dcache_toobig_note(vnode_t *dir, int limit)
+{
+        int i = dcache_toobig_next;
+
+        dcache_toobig_next = (i + 1) % DCACHE_NTOOBIG;
+        dcache_toobig[i].tb_fs = dir->vn_fs;
+        dcache_toobig[i].tb_vno = dir->vn_vno;
+        dcache_toobig[i].tb_len = dir->vn_len;
+        dcache_toobig[i].tb_limit = limit;
+}
+
+/* Forgets any directory of fs (any at all if fs is NULL) as too big. */
+static void dcache_toobig_forget(fs_t *fs, ino_t vno)
+{
+        int i;
+
+        for (i = 0; i < DCACHE_NTOOBIG; i++)
+        {
+                if (NULL == fs ||
+                    (dcache_toobig[i].tb_fs == fs && dcache_toobig[i].tb_vno == vno))
+                {
+                        dcache_toobig[i].tb_fs = NULL;
+                }
+        }
+}
+
+/*
+ * Reads all of dir into a new index. Gives up, forgetting what it read,
+ * if the directory changes meanwhile (readdir may block), and as soon as
+ * it turns out to be too big, which is then remembered (see
+ * dcache_toobig_find()). Returns the index if it is complete.
+ */
+static dir_index_t *dcache_index_build(vnode_t *dir)
+{
+        dir_index_t *di;
+        dentry_t *d;
+        dirent_t de;
+        off_t off = 0;
+        int limit = dcache_index_limit();
+        int res;
+
+        if (dcache_nindexes >= DCACHE_NINDEX)
+        {
+                /* the oldest one that is not being built */
+                list_iterate_begin(&dcache_indexes, di, dir_index_t, di_link)
+                {
+                        if (!di->di_building)
+                        {
+                                dcache_index_drop(di);
+                                break;
+                        }
+                }
+                list_iterate_end();
+                if (dcache_nindexes >= DCACHE_NINDEX)
+                {
+                        return NULL;
+                }
+        }
+        if (NULL == (di = (dir_index_t *)kmalloc(sizeof(dir_index_t))))
+        {
+                return NULL;
+        }
+        di->di_fs = dir->vn_fs;
+        di->di_vno = dir->vn_vno;
+        di->di_building = 1;
+        di->di_complete = 0;
+        di->di_stale = 0;
+        di->di_count = 0;
+        di->di_limit = limit;
+        list_init(&di->di_ents);
+        list_insert_tail(&dcache_indexes, &di->di_link);
+        dcache_nindexes++;
+
+        while ((res = dir->vn_ops->readdir(dir, off, &de)) > 0)
+        {
+                off += res;
+                if (di->di_count >= limit)
+                {
+                        dcache_toobig_note(dir, limit);
+                        res = -1;
+                        break;
+                }
+                if (di->di_stale ||
+                    NULL == (d = dcache_get(dir, de.d_name, strlen(de.d_name))))
+                {
+                        res = -1;
+                        break;
+                }
+                if (DENT_POSITIVE != d->d_state)
+                {
+#ifdef __MOUNTING__
+                        /* d_ino does not know about mount points */
+                        dcache_set(d, DENT_UNKNOWN, NULL, 0);
+#else
+                        dcache_set(d, DENT_POSITIVE, dir->vn_fs, de.d_ino);
+#endif
+                }
+        }
+
+        di->di_building = 0;
+        if (res < 0 || di->di_stale)
+        {
+                dcache_index_drop(di);
+                return NULL;
+        }
+        di->di_complete = 1;
+        dcache_stats.ds_indexed++;
+        return di;
+}
+
+/*
+ * Looks name up in dir. On a hit returns 1 with a new reference to the
+ * vnode in *result, or -ENOENT for a negative entry; returns 0 on a miss.
+ */
+int dcache_lookup(vnode_t *dir, const char *name, size_t len, vnode_t **result)
+{
+        dir_index_t *di;
+        dentry_t *d;
+
+        if (len > NAME_LEN)
+        {
+                dcache_stats.ds_misses++;
+                return 0;
+        }
+        if (NULL == (d = dcache_find(dir, name, len)))
+        {
+                di = dcache_index_find(dir->vn_fs, dir->vn_vno);
+                if (NULL == di && dir->vn_len >= DCACHE_INDEX_MINLEN &&
+                    !dcache_toobig_find(dir))
+                {
+                        di = dcache_index_build(dir);
+                        d = dcache_find(dir, name, len);
+                }
+                if (NULL == d)
+                {
+                        if (NULL != di && di->di_complete)
+                        {
+                                dcache_stats.ds_neghits++;
+                                return -ENOENT;
+                        }
+                        dcache_stats.ds_misses++;
+                        return 0;
+                }
+        }
+
+        if (NULL != d->d_index)
+        {
+                list_remove(&d->d_index->di_link);
+                list_insert_tail(&dcache_indexes, &d->d_index->di_link);
+        }
+        else
+        {
+                list_remove(&d->d_lrulink);
+                list_insert_tail(&dcache_lru, &d->d_lrulink);
+        }
+        if (DENT_UNKNOWN == d->d_state)
+        {
+                dcache_stats.ds_misses++;
+                return 0;
+        }
+        if (DENT_NEGATIVE == d->d_state)
+        {
+                dcache_stats.ds_neghits++;
+                return -ENOENT;
+        }
+        if (NULL == (*result = vget(d->d_childfs, d->d_childvno)))
+        {
+                dcache_stats.ds_misses++;
+                return 0;
+        }
+        dcache_stats.ds_hits++;
+        return 1;
+}
+
+/*
+ * Records that name in dir resolves to vn, or, if vn is NULL, that it does
+ * not exist. Replaces whatever was known about the name.
+ */
+void dcache_enter(vnode_t *dir, const char *name, size_t len, vnode_t *vn)
+{
+        dentry_t *d;
+
+        if (len > NAME_LEN || NULL == (d = dcache_get(dir, name, len)))
+        {
+                return;
+        }
+        if (NULL == d->d_index)
+        {
+                list_remove(&d->d_lrulink);
+                list_insert_tail(&dcache_lru, &d->d_lrulink);
+        }
+
+        if (NULL == vn)
+        {
+                dcache_set(d, DENT_NEGATIVE, NULL, 0);
+        }
+        else
+        {
+                dcache_set(d, DENT_POSITIVE, vn->vn_fs, vn->vn_vno);
+        }
+}
+
+/*
+ * Forgets what is known about name in dir. In an indexed directory the
+ * name is kept as unknown, since it may now exist.
+ */
+void dcache_invalidate(vnode_t *dir, const char *name, size_t len)
+{
+        dir_index_t *di = dcache_index_find(dir->vn_fs, dir->vn_vno);
+        dentry_t *d;
+
+        if (len > NAME_LEN)
+        {
+                return;
+        }
+        dcache_stats.ds_invalidations++;
+        if (NULL == di)
+        {
+                if (NULL != (d = dcache_find(dir, name, len)))
+                {
+                        dcache_drop(d);
+                }
+                return;
+        }
+
+        di->di_stale = 1;
+        if (di->di_complete)
+        {
+                if (NULL != (d = dcache_get(dir, name, len)))
+                {
+                        dcache_set(d, DENT_UNKNOWN, NULL, 0);
+                }
+                else if (NULL != (di = dcache_index_find(dir->vn_fs, dir->vn_vno)))
+                {
+                        /* cannot say the name is unknown, so a miss is not final */
+                        di->di_complete = 0;
+                }
+        }
+        else if (NULL != (d = dcache_find(dir, name, len)))
+        {
+                dcache_set(d, DENT_UNKNOWN, NULL, 0);
+        }
+}
+
+/*
+ * Forgets every entry in the directory numbered vno in fs, which has been
+ * removed; its number may be given to a new directory.
+ */
+void dcache_purge_dir(fs_t *fs, ino_t vno)
+{
+        dir_index_t *di;
+        dentry_t *d;
+
+        dcache_toobig_forget(fs, vno);
+        if (NULL != (di = dcache_index_find(fs, vno)))
+        {
+                if (!di->di_building)
+                {
+                        dcache_index_drop(di);
+                }
+                else
+                {
+                        di->di_stale = 1;
+                }
+        }
+        list_iterate_begin(&dcache_lru, d, dentry_t, d_lrulink)
+        {
+                if (d->d_fs == fs && d->d_dirvno == vno)
+                {
+                        dcache_drop(d);
+                        dcache_stats.ds_invalidations++;
+                }
+        }
+        list_iterate_end();
+}
+
+/*
+ * Finds a name vn is known by, in dir if dir is not NULL. Returns 1 and
+ * copies the name into name, which must hold NAME_LEN + 1 bytes, and the
+ * directory it is in into *dirfs and *dirvno; returns 0 if none is known.
+ */
+int dcache_name(vnode_t *vn, vnode_t *dir, char *name, fs_t **dirfs, ino_t *dirvno)
+{
+        dentry_t *d;
+
+        list_iterate_begin(dcache_rbucket(vn->vn_fs, vn->vn_vno), d, dentry_t, d_rlink)
+        {
+                if (d->d_childfs == vn->vn_fs && d->d_childvno == vn->vn_vno &&
+                    (NULL == dir || (d->d_fs == dir->vn_fs && d->d_dirvno == dir->vn_vno)))
+                {
+                        strcpy(name, d->d_name);
+                        *dirfs = d->d_fs;
+                        *dirvno = d->d_dirvno;
+                        dcache_stats.ds_hits++;
+                        return 1;
+                }
+        }
+        list_iterate_end();
+        dcache_stats.ds_misses++;
+        return 0;
+}
+
+/* Empties the cache, e.g. before a file system goes away. */
+void dcache_purge(void)
+{
+        dir_index_t *di;
+        dentry_t *d;
+
+        dcache_toobig_forget(NULL, 0);
+        list_iterate_begin(&dcache_indexes, di, dir_index_t, di_link)
+        {
+                if (!di->di_building)
+                {
+                        dcache_index_drop(di);
+                }
+                else
+                {
+                        di->di_stale = 1;
+                }
+        }
+        list_iterate_end();
+        list_iterate_begin(&dcache_lru, d, dentry_t, d_lrulink)
+        {
+                dcache_drop(d);
+        }
+        list_iterate_end();
+}
+
+/* a debugging routine: dumps the cache's statistics. */
+size_t
+dcache_info(const void *unused, char *buf, size_t osize)
+{
+        int len;
+
+        KASSERT(0 < osize);
+        KASSERT(NULL != buf);
+
+        len = snprintf(buf, osize,
+                       "dcache: %d/%d entries, %d/%d indexed directories, "
+                       "%u hits, %u negative hits, %u misses, %u evictions, "
+                       "%u invalidations, %u indexes built\n",
+                       dcache_count, DCACHE_MAX, dcache_nindexes, DCACHE_NINDEX,
+                       dcache_stats.ds_hits, dcache_stats.ds_neghits,
+                       dcache_stats.ds_misses, dcache_stats.ds_evictions,
+                       dcache_stats.ds_invalidations, dcache_stats.ds_indexed);
+        if (len < 0 || (size_t)len >= osize)
+        {
+                buf[osize - 1] = '\0';
+                return osize;
+        }
+        return len;
+}
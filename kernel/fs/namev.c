@@ -12,6 +12,7 @@
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
+#include "fs/dcache.h"
 
 /* This takes a base 'dir', a 'name', its 'len', and a result vnode.
  * Most of the work should be done by the vnode's implementation
@@ -19,6 +20,9 @@
  *
  * If dir has no lookup(), return -ENOTDIR.
  *
+ * The directory entry cache is asked first, and told the file system's
+ * answer, whether the name exists or not.
+ *
  * Note: returns with the vnode refcount on *result incremented.
  */
 int lookup(vnode_t *dir, const char *name, size_t len, vnode_t **result)
@@ -37,165 +41,151 @@ int lookup(vnode_t *dir, const char *name, size_t len, vnode_t **result)
         //         return -ENOTDIR;
         // }
 
+        int res = dcache_lookup(dir, name, len, result);
+        if (0 != res)
+        {
+                dbg(DBG_PRINT, "(GRADING2B)\n");
+                return (res < 0) ? res : 0;
+        }
+
         // if dir has lookup(), call it. The vnode_t returned by lookup() should be stored in result.
-        int res = dir->vn_ops->lookup(dir, name, len, result);
+        res = dir->vn_ops->lookup(dir, name, len, result);
+        if (0 == res)
+        {
+                dcache_enter(dir, name, len, *result);
+        }
+        else if (-ENOENT == res)
+        {
+                dcache_enter(dir, name, len, NULL);
+        }
         dbg(DBG_PRINT, "(GRADING2B)\n");
         return res;
 }
 
-/* When successful this function returns data in the following "out"-arguments:
- *  o res_vnode: the vnode of the parent directory of "name"
- *  o name: the `basename' (the element of the pathname)
- *  o name_len: the length of the basename
- *
- * For example: dir_namev("/s5fs/bin/ls", &name_len, &name, NULL,
- * &res_vnode) would put 2 in name_len, "ls" in name, and a pointer to the
- * vnode corresponding to "/s5fs/bin" in res_vnode.
- *
- * The "base" argument defines where we start resolving the path from:
- * A base value of NULL means to use the process's current working directory,
- * curproc->p_cwd.  If pathname[0] == '/', ignore base and start with
- * vfs_root_vn.  dir_namev() should call lookup() to take care of resolving each
- * piece of the pathname.
+/*
+ * Walks pathname from base (see dir_namev()) in a single forward pass,
+ * looking up every component but the last. Returns, with a reference, the
+ * directory the last component is in, and that component in *name and
+ * *name_len; *name_len is 0 if the path is empty or ends in a slash, in
+ * which case the directory is the named one itself.
  *
- * Note: A successful call to this causes vnode refcount on *res_vnode to
- * be incremented.
+ * At most one vnode is held at a time: lookup() hands over a reference to
+ * the next directory and the previous one is dropped. The starting
+ * directory is held by curproc or the vfs, so it is only referenced if it
+ * is also the result, and "." components are skipped without a lookup.
  */
-
-int dir_namev(const char *pathname, size_t *name_len, const char **name,
-              vnode_t *base, vnode_t **res_vnode)
+static int namev_walk(const char *pathname, vnode_t *base, size_t *name_len,
+                      const char **name, vnode_t **res_vnode)
 {
-        // NOT_YET_IMPLEMENTED("VFS: dir_namev");
-        vnode_t *cur_base = base;
+        vnode_t *dir = base;    /* the directory being searched */
+        vnode_t *held = NULL;   /* dir, if it is referenced by us */
+        vnode_t *next;
+        const char *p = pathname;
+        const char *comp;
+        size_t len;
+        int res;
 
-        KASSERT(NULL != pathname);
-        KASSERT(NULL != name_len);
-        KASSERT(NULL != name);
-        KASSERT(NULL != res_vnode);
-        dbg(DBG_PRINT, "(GRADING2A 2.b)\n");
-        const char *cur_path = pathname;
-
-        // change cur_base according to different cases --check pathname first
-
-        if (base == NULL)
+        if (NULL == dir)
         {
-                cur_base = curproc->p_cwd;
+                dir = curproc->p_cwd;
                 dbg(DBG_PRINT, "(GRADING2B)\n");
         }
-        if ('/' == cur_path[0])
+        if ('/' == *p)
         {
-                cur_base = vfs_root_vn;
+                dir = vfs_root_vn;
                 dbg(DBG_PRINT, "(GRADING2B)\n");
         }
 
-        // find index limit of res_vnode parent directory
-        // exclude last file of pathname
-        int dir_index_limit = strlen(cur_path) - 1;
-        while (dir_index_limit >= 0 && '/' != cur_path[dir_index_limit])
+        for (;;)
         {
-                dir_index_limit--;
-                dbg(DBG_PRINT, "(GRADING2B)\n");
-        }
-        // get the name of the file
-        *name_len = strlen(cur_path) - (dir_index_limit + 1);
-        // if pathname has last file
-        if (*name_len > 0)
-        {
-                // check last file name length
-                if (*name_len > NAME_LEN)
+                while ('/' == *p)
                 {
-                        dbg(DBG_PRINT, "(GRADING2B)\n");
-                        return -ENAMETOOLONG;
+                        p++;
                 }
-                // if pathname has at least 1 slash
-                if (dir_index_limit >= 0)
+                comp = p;
+                while ('\0' != *p && '/' != *p)
                 {
-                        *name = &pathname[dir_index_limit] + 1;
-                        dbg(DBG_PRINT, "(GRADING2B)\n");
+                        p++;
                 }
-                // if pathname has no slash
-                else
+                len = p - comp;
+
+                if (NULL == dir->vn_ops->lookup)
                 {
-                        *name = &pathname[0];
-                        dbg(DBG_PRINT, "(GRADING2B)\n");
+                        res = -ENOTDIR;
+                        break;
                 }
-        }
-
-        int cur_pos = 0;
-        int next_pos = 0;
-
-        // skip slash
-        while (next_pos < dir_index_limit && '/' == pathname[next_pos])
-        {
-                next_pos++;
-                dbg(DBG_PRINT, "(GRADING2B)\n");
-        }
-
-        vnode_t *cur_node = NULL;
-        vnode_t *prev_node = NULL;
-        // try to search each file in pathname until index limit
-        while (next_pos < dir_index_limit)
-        {
-                // first non-slash char
-                cur_pos = next_pos;
-                // put next_pos to next slash or end
-                while (next_pos < dir_index_limit && '/' != pathname[next_pos])
+                if (len > NAME_LEN)
                 {
-
-                        next_pos++;
-                        dbg(DBG_PRINT, "(GRADING2B)\n");
+                        res = -ENAMETOOLONG;
+                        break;
                 }
-                int len = next_pos - cur_pos;
-
-                // lookup next file from cur_base
-                int res = lookup(cur_base, &pathname[cur_pos], len, &cur_node); // if lookup succeeds, cur_node refcount is incremented
-
-                if (prev_node != NULL)
+                if ('\0' == *p)
                 {
-                        // decrement the refcount of prev_node
-                        vput(prev_node);
+                        if (NULL == held)
+                        {
+                                vref(dir);
+                        }
+                        *name = comp;
+                        *name_len = len;
+                        *res_vnode = dir;
                         dbg(DBG_PRINT, "(GRADING2B)\n");
+                        return 0;
                 }
-                if (res < 0)
+                if (1 == len && '.' == comp[0])
                 {
-                        dbg(DBG_PRINT, "(GRADING2B)\n");
-                        return res;
+                        continue;
                 }
 
-                // change cur_base to next file, prev_node to cur_node
-                prev_node = cur_node;
-                cur_base = cur_node;
-                // skip slash
-                while (next_pos < dir_index_limit && '/' == pathname[next_pos])
+                if ((res = lookup(dir, comp, len, &next)) < 0)
                 {
-                        next_pos++;
-                        dbg(DBG_PRINT, "(GRADING2B)\n");
+                        break;
                 }
+                if (NULL != held)
+                {
+                        vput(held);
+                }
+                dir = held = next;
                 dbg(DBG_PRINT, "(GRADING2B)\n");
         }
 
-        // if pathname >= 2 layer
-        if (NULL != cur_node && cur_base->vn_ops->lookup == NULL)
-        {
-                vput(cur_node);
-                dbg(DBG_PRINT, "(GRADING2B)\n");
-                return -ENOTDIR;
-        }
-
-        if (NULL == cur_node)
+        if (NULL != held)
         {
-                *res_vnode = cur_base;
-                next_pos++;
-                vref(*res_vnode);
-                dbg(DBG_PRINT, "(GRADING2B)\n");
-        }
-        else
-        {
-                *res_vnode = cur_node;
-                dbg(DBG_PRINT, "(GRADING2B)\n");
+                vput(held);
         }
         dbg(DBG_PRINT, "(GRADING2B)\n");
-        return 0;
+        return res;
+}
+
+/* When successful this function returns data in the following "out"-arguments:
+ *  o res_vnode: the vnode of the parent directory of "name"
+ *  o name: the `basename' (the element of the pathname)
+ *  o name_len: the length of the basename
+ *
+ * For example: dir_namev("/s5fs/bin/ls", &name_len, &name, NULL,
+ * &res_vnode) would put 2 in name_len, "ls" in name, and a pointer to the
+ * vnode corresponding to "/s5fs/bin" in res_vnode.
+ *
+ * The "base" argument defines where we start resolving the path from:
+ * A base value of NULL means to use the process's current working directory,
+ * curproc->p_cwd.  If pathname[0] == '/', ignore base and start with
+ * vfs_root_vn.  dir_namev() should call lookup() to take care of resolving each
+ * piece of the pathname.
+ *
+ * Note: A successful call to this causes vnode refcount on *res_vnode to
+ * be incremented.
+ */
+
+int dir_namev(const char *pathname, size_t *name_len, const char **name,
+              vnode_t *base, vnode_t **res_vnode)
+{
+        // NOT_YET_IMPLEMENTED("VFS: dir_namev");
+        KASSERT(NULL != pathname);
+        KASSERT(NULL != name_len);
+        KASSERT(NULL != name);
+        KASSERT(NULL != res_vnode);
+        dbg(DBG_PRINT, "(GRADING2A 2.b)\n");
+
+        return namev_walk(pathname, base, name_len, name, res_vnode);
 }
 
 /* This returns in res_vnode the vnode requested by the other parameters.
@@ -218,8 +208,8 @@ int open_namev(const char *pathname, int flag, vnode_t **res_vnode, vnode_t *bas
         const char *name = NULL;
         vnode_t *dir_node = NULL;
 
-        // resolve pathname
-        int res = dir_namev(pathname, &name_len, &name, base, &dir_node);
+        // resolve all but the last component of pathname
+        int res = namev_walk(pathname, base, &name_len, &name, &dir_node);
 
         // if res < 0, parent directory does not exist
         if (res < 0)
@@ -257,6 +247,11 @@ int open_namev(const char *pathname, int flag, vnode_t **res_vnode, vnode_t *bas
                         dbg(DBG_PRINT, "(GRADING2A 2.c)\n");
                         // create last file
                         res = dir_node->vn_ops->create(dir_node, name, name_len, res_vnode); // if create succeeds, res_vnode refcount is incremented
+                        if (0 == res)
+                        {
+                                dcache_enter(dir_node, name, name_len, *res_vnode);
+                                dir_node->vn_statvalid = 0;
+                        }
                         vput(dir_node);                                                      // decrement the refcount of dir_node
                         dbg(DBG_PRINT, "(GRADING2B)\n");
                         return res;
@@ -272,6 +267,26 @@ int open_namev(const char *pathname, int flag, vnode_t **res_vnode, vnode_t *bas
 }
 
 #ifdef __GETCWD__
+/* Copies name into buf, truncating it and returning -ERANGE if it does
+ * not fit. */
+static int namev_copy_name(const char *name, char *buf, size_t size)
+{
+        size_t len = strlen(name);
+
+        if (0 == size)
+        {
+                return -ERANGE;
+        }
+        if (len >= size)
+        {
+                memcpy(buf, name, size - 1);
+                buf[size - 1] = '\0';
+                return -ERANGE;
+        }
+        memcpy(buf, name, len + 1);
+        return 0;
+}
+
 /* Finds the name of 'entry' in the directory 'dir'. The name is writen
  * to the given buffer. On success 0 is returned. If 'dir' does not
  * contain 'entry' then -ENOENT is returned. If the given buffer cannot
@@ -279,11 +294,41 @@ int open_namev(const char *pathname, int flag, vnode_t **res_vnode, vnode_t *bas
  * and a null terminator, -ERANGE is returned.
  *
  * Files can be uniquely identified within a file system by their
- * inode numbers. */
+ * inode numbers. The directory entry cache usually knows the name; only
+ * if it does not is 'dir' read, and what is found is given to the cache. */
 int lookup_name(vnode_t *dir, vnode_t *entry, char *buf, size_t size)
 {
-        NOT_YET_IMPLEMENTED("GETCWD: lookup_name");
-        return -ENOENT;
+        char name[NAME_LEN + 1];
+        dirent_t de;
+        fs_t *dirfs;
+        ino_t dirvno;
+        off_t off = 0;
+        int res;
+
+        if (dcache_name(entry, dir, name, &dirfs, &dirvno))
+        {
+                return namev_copy_name(name, buf, size);
+        }
+
+        if (NULL == dir->vn_ops->readdir)
+        {
+                return -ENOTDIR;
+        }
+        if (dir->vn_fs != entry->vn_fs)
+        {
+                return -ENOENT;
+        }
+        while ((res = dir->vn_ops->readdir(dir, off, &de)) > 0)
+        {
+                off += res;
+                if (de.d_ino == entry->vn_vno && 0 != strcmp(de.d_name, ".") &&
+                    0 != strcmp(de.d_name, ".."))
+                {
+                        dcache_enter(dir, de.d_name, strlen(de.d_name), entry);
+                        return namev_copy_name(de.d_name, buf, size);
+                }
+        }
+        return (res < 0) ? res : -ENOENT;
 }
 
 /* Used to find the absolute path of the directory 'dir'. Since
@@ -293,12 +338,91 @@ int lookup_name(vnode_t *dir, vnode_t *entry, char *buf, size_t size)
  * negative error res. See the man page for getcwd(3) for
  * possible errors. Even if an error res is returned the buffer
  * will be filled with a valid string which has some partial
- * information about the wanted path. */
+ * information about the wanted path.
+ *
+ * The path is put together from the end of the buffer backwards while
+ * walking up to the root: the directory entry cache gives each
+ * directory's name and parent, so a cached path costs one hash lookup
+ * per component and reads no directories. Otherwise ".." is looked up
+ * and searched with lookup_name(). On error the buffer holds the part of
+ * the path found so far. */
 ssize_t
 lookup_dirpath(vnode_t *dir, char *buf, size_t osize)
 {
-        NOT_YET_IMPLEMENTED("GETCWD: lookup_dirpath");
+        char name[NAME_LEN + 1];
+        vnode_t *vn = dir;
+        vnode_t *parent;
+        fs_t *dirfs;
+        ino_t dirvno;
+        size_t pos, len;
+        int res = 0;
 
-        return -ENOENT;
+        if (0 == osize)
+        {
+                return -ERANGE;
+        }
+        pos = osize - 1;
+        buf[pos] = '\0';
+
+        vref(vn);
+        while (vn != vfs_root_vn)
+        {
+                if (dcache_name(vn, NULL, name, &dirfs, &dirvno))
+                {
+                        if (NULL == (parent = vget(dirfs, dirvno)))
+                        {
+                                res = -ENOENT;
+                                break;
+                        }
+                }
+                else
+                {
+                        if ((res = lookup(vn, "..", 2, &parent)) < 0)
+                        {
+                                break;
+                        }
+                        if (parent == vn)
+                        {
+                                /* the root of a file system that is not mounted */
+                                vput(parent);
+                                res = -ENOENT;
+                                break;
+                        }
+                        if ((res = lookup_name(parent, vn, name, sizeof(name))) < 0)
+                        {
+                                vput(parent);
+                                break;
+                        }
+                }
+
+                len = strlen(name);
+                if (pos < len + 1)
+                {
+                        vput(parent);
+                        res = -ERANGE;
+                        break;
+                }
+                pos -= len;
+                memcpy(buf + pos, name, len);
+                buf[--pos] = '/';
+
+                vput(vn);
+                vn = parent;
+        }
+        vput(vn);
+
+        if (0 == res && pos == osize - 1)
+        {
+                if (0 == pos)
+                {
+                        return -ERANGE;
+                }
+                buf[--pos] = '/';
+        }
+        for (len = 0; pos + len < osize; len++)
+        {
+                buf[len] = buf[pos + len];
+        }
+        return res;
 }
 #endif /* __GETCWD__ */
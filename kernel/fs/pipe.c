@@ -0,0 +1,680 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/init.h"
+#include "util/string.h"
+#include "util/list.h"
+#include "util/debug.h"
+
+#include "proc/sched.h"
+
+#include "mm/page.h"
+#include "mm/kmalloc.h"
+
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#include "fs/file.h"
+#include "fs/open.h"
+#include "fs/stat.h"
+#include "fs/poll.h"
+#include "fs/vfs_syscall.h"
+
+#ifdef __PIPES__
+
+/*
+ * Pipes. Each pipe is a ring of page-sized buffers shared by two vnodes
+ * of a private "pipefs", one for each end. The vnode of an end goes away
+ * once the last file_t referring to it is closed, which is how a pipe
+ * learns that it has lost its readers or writers.
+ *
+ * Sleepers are woken one at a time. A reader that leaves data behind
+ * wakes the next reader, and a writer that leaves room behind wakes the
+ * next writer, so a wakeup is never spent on a thread that would just go
+ * back to sleep. Closing an end starts the same chain.
+ *
+ * A reader that finds the pipe empty and asks for at least a page offers
+ * its buffers to the writers, and the next writer copies into them
+ * directly: one copy instead of two when a large reader is waiting.
+ * Otherwise every byte is copied into the ring and out again; pages are
+ * never passed from writer to reader.
+ */
+
+#define PIPE_NBUFS      16              /* pages in the ring */
+#define PIPE_ATOMIC     PAGE_SIZE       /* writes up to this size are not interleaved */
+#define PIPE_DIRECT_MIN PAGE_SIZE       /* smallest read that is written to directly */
+
+#define PIPE_READ  0
+#define PIPE_WRITE 1
+
+typedef struct pipe_buf {
+        char   *pb_page;        /* allocated on first use, kept until the pipe goes */
+        size_t  pb_off;         /* first unread byte */
+        size_t  pb_len;         /* bytes not yet read */
+} pipe_buf_t;
+
+typedef struct pipe {
+        int             p_id;
+        pipe_buf_t      p_bufs[PIPE_NBUFS];
+        int             p_head;         /* oldest buffer holding data */
+        int             p_nbufs;        /* buffers holding data */
+        int             p_readers;      /* read end is open */
+        int             p_writers;      /* write end is open */
+        ktqueue_t       p_rq;           /* readers waiting for data */
+        ktqueue_t       p_wq;           /* writers waiting for room */
+        pollq_t         p_pollq;        /* pollers of either end */
+
+        /* reader waiting with its buffer offered to the writers */
+        kthread_t      *p_direct;
+        ktqueue_t       p_dq;
+        const struct iovec *p_diov;
+        int             p_diovcnt;
+        size_t          p_dlen;
+        size_t          p_dgot;
+
+        list_link_t     p_link;
+} pipe_t;
+
+#define VNODE_TO_PIPE(vn)     ((pipe_t *)(vn)->vn_i)
+#define PIPE_VNO(p, end)      ((ino_t)((p)->p_id * 2 + (end)))
+#define PIPE_VNO_END(vno)     ((int)((vno) % 2))
+#define PIPE_VNO_ID(vno)      ((int)((vno) / 2))
+
+static int pipe_read(vnode_t *vn, off_t off, void *buf, size_t count);
+static int pipe_write(vnode_t *vn, off_t off, const void *buf, size_t count);
+static int pipe_readv(vnode_t *vn, off_t off, const struct iovec *iov, int iovcnt);
+static int pipe_writev(vnode_t *vn, off_t off, const struct iovec *iov, int iovcnt);
+static int pipe_stat(vnode_t *vn, struct stat *ss);
+static int pipe_poll(vnode_t *vn, pollq_t **pq);
+
+static void pipe_read_vnode(vnode_t *vn);
+static void pipe_delete_vnode(vnode_t *vn);
+static int pipe_query_vnode(vnode_t *vn);
+
+static vnode_ops_t pipe_vops = {
+    .read = pipe_read,
+    .write = pipe_write,
+    .mmap = NULL,
+    .create = NULL,
+    .mknod = NULL,
+    .lookup = NULL,
+    .link = NULL,
+    .unlink = NULL,
+    .mkdir = NULL,
+    .rmdir = NULL,
+    .readdir = NULL,
+    .stat = pipe_stat,
+    .fillpage = NULL,
+    .dirtypage = NULL,
+    .cleanpage = NULL,
+    .poll = pipe_poll,
+    .readv = pipe_readv,
+    .writev = pipe_writev
+};
+
+static fs_ops_t pipe_fsops = {
+    .read_vnode = pipe_read_vnode,
+    .delete_vnode = pipe_delete_vnode,
+    .query_vnode = pipe_query_vnode,
+    .umount = NULL
+};
+
+static fs_t pipe_fs;
+static list_t pipe_list;
+static int pipe_nextid;
+
+static __attribute__((unused)) void pipe_init(void)
+{
+        strcpy(pipe_fs.fs_type, "pipefs");
+        pipe_fs.fs_op = &pipe_fsops;
+        pipe_fs.fs_root = NULL;
+        list_init(&pipe_list);
+}
+init_func(pipe_init);
+
+static pipe_t *pipe_alloc(void)
+{
+        pipe_t *p;
+
+        if (NULL == (p = (pipe_t *)kmalloc(sizeof(pipe_t))))
+        {
+                return NULL;
+        }
+        memset(p, 0, sizeof(pipe_t));
+        p->p_id = pipe_nextid++;
+        sched_queue_init(&p->p_rq);
+        sched_queue_init(&p->p_wq);
+        sched_queue_init(&p->p_dq);
+        pollq_init(&p->p_pollq);
+        list_insert_tail(&pipe_list, &p->p_link);
+        return p;
+}
+
+static void pipe_free(pipe_t *p)
+{
+        int i;
+
+        KASSERT(!p->p_readers && !p->p_writers);
+        for (i = 0; i < PIPE_NBUFS; i++)
+        {
+                if (NULL != p->p_bufs[i].pb_page)
+                {
+                        page_free(p->p_bufs[i].pb_page);
+                }
+        }
+        list_remove(&p->p_link);
+        kfree(p);
+}
+
+/*
+ * Returns the address of byte at of the vector iov, and in *len how many
+ * bytes follow it in the same buffer.
+ */
+static char *pipe_iov_at(const struct iovec *iov, int iovcnt, size_t at, size_t *len)
+{
+        int i;
+
+        for (i = 0; i < iovcnt; i++)
+        {
+                if (at < iov[i].iov_len)
+                {
+                        *len = iov[i].iov_len - at;
+                        return (char *)iov[i].iov_base + at;
+                }
+                at -= iov[i].iov_len;
+        }
+        *len = 0;
+        return NULL;
+}
+
+/*
+ * Copies n bytes between buf and the vector iov, starting at byte at of
+ * the vector: into the vector if tovec, out of it otherwise.
+ */
+static void pipe_iov_copy(char *buf, size_t n, const struct iovec *iov, int iovcnt,
+                          size_t at, int tovec)
+{
+        char *seg;
+        size_t len;
+
+        while (n > 0)
+        {
+                seg = pipe_iov_at(iov, iovcnt, at, &len);
+                KASSERT(NULL != seg);
+                len = MIN(len, n);
+                if (tovec)
+                {
+                        memcpy(seg, buf, len);
+                }
+                else
+                {
+                        memcpy(buf, seg, len);
+                }
+                buf += len;
+                at += len;
+                n -= len;
+        }
+}
+
+/* Bytes that can be written before the ring is full. */
+static size_t pipe_room(pipe_t *p)
+{
+        size_t room = (PIPE_NBUFS - p->p_nbufs) * PAGE_SIZE;
+        pipe_buf_t *tail;
+
+        if (p->p_nbufs > 0)
+        {
+                tail = &p->p_bufs[(p->p_head + p->p_nbufs - 1) % PIPE_NBUFS];
+                room += PAGE_SIZE - (tail->pb_off + tail->pb_len);
+        }
+        return room;
+}
+
+/*
+ * Appends up to count bytes of the vector iov, starting at its byte at,
+ * to the ring, filling the last buffer before starting a new one. Wakes
+ * one reader if the pipe was empty. Returns the number of bytes taken, 0
+ * if the ring is full.
+ */
+static size_t pipe_copyin(pipe_t *p, const struct iovec *iov, int iovcnt,
+                          size_t at, size_t count)
+{
+        int wasempty = (0 == p->p_nbufs);
+        size_t done = 0;
+        size_t n, end;
+        pipe_buf_t *pb;
+
+        while (done < count)
+        {
+                pb = (p->p_nbufs > 0) ? &p->p_bufs[(p->p_head + p->p_nbufs - 1) % PIPE_NBUFS]
+                                      : NULL;
+                if (NULL == pb || PAGE_SIZE == pb->pb_off + pb->pb_len)
+                {
+                        if (PIPE_NBUFS == p->p_nbufs)
+                        {
+                                break;
+                        }
+                        pb = &p->p_bufs[(p->p_head + p->p_nbufs) % PIPE_NBUFS];
+                        if (NULL == pb->pb_page && NULL == (pb->pb_page = page_alloc()))
+                        {
+                                break;
+                        }
+                        pb->pb_off = 0;
+                        pb->pb_len = 0;
+                        p->p_nbufs++;
+                }
+                end = pb->pb_off + pb->pb_len;
+                n = MIN(count - done, PAGE_SIZE - end);
+                pipe_iov_copy(pb->pb_page + end, n, iov, iovcnt, at + done, 0);
+                pb->pb_len += n;
+                done += n;
+        }
+
+        if (wasempty && done > 0)
+        {
+                sched_wakeup_on(&p->p_rq);
+                pollq_wake(&p->p_pollq);
+        }
+        return done;
+}
+
+/*
+ * Takes up to count bytes off the front of the ring into the vector iov,
+ * starting at its byte at. Wakes one writer if a buffer was emptied.
+ * Returns the number of bytes taken.
+ */
+static size_t pipe_copyout(pipe_t *p, const struct iovec *iov, int iovcnt,
+                           size_t at, size_t count)
+{
+        int freed = 0;
+        size_t done = 0;
+        size_t n;
+        pipe_buf_t *pb;
+
+        while (done < count && p->p_nbufs > 0)
+        {
+                pb = &p->p_bufs[p->p_head];
+                n = MIN(count - done, pb->pb_len);
+                pipe_iov_copy(pb->pb_page + pb->pb_off, n, iov, iovcnt, at + done, 1);
+                pb->pb_off += n;
+                pb->pb_len -= n;
+                done += n;
+                if (0 == pb->pb_len)
+                {
+                        pb->pb_off = 0;
+                        p->p_head = (p->p_head + 1) % PIPE_NBUFS;
+                        p->p_nbufs--;
+                        freed = 1;
+                }
+        }
+
+        if (freed)
+        {
+                sched_wakeup_on(&p->p_wq);
+                pollq_wake(&p->p_pollq);
+        }
+        return done;
+}
+
+/*
+ * Blocks until there is data or the write end is closed, then returns
+ * whatever is there, up to the length of the vector iov, filling its
+ * buffers in order. Returns 0 at end of file.
+ */
+static int pipe_readv(vnode_t *vn, off_t off, const struct iovec *iov, int iovcnt)
+{
+        pipe_t *p = VNODE_TO_PIPE(vn);
+        size_t count = 0, got = 0;
+        int i, direct, err;
+
+        KASSERT(PIPE_READ == PIPE_VNO_END(vn->vn_vno));
+
+        for (i = 0; i < iovcnt; i++)
+        {
+                count += iov[i].iov_len;
+        }
+        if (0 == count)
+        {
+                return 0;
+        }
+
+        while (0 == p->p_nbufs)
+        {
+                if (!p->p_writers)
+                {
+                        /* pass the end of file on to the next reader */
+                        sched_wakeup_on(&p->p_rq);
+                        dbg(DBG_PRINT, "(GRADING2B)\n");
+                        return 0;
+                }
+
+                direct = (count >= PIPE_DIRECT_MIN && NULL == p->p_direct);
+                if (direct)
+                {
+                        p->p_direct = curthr;
+                        p->p_diov = iov;
+                        p->p_diovcnt = iovcnt;
+                        p->p_dlen = count;
+                        p->p_dgot = 0;
+                        err = sched_cancellable_sleep_on(&p->p_dq);
+                        got = p->p_dgot;
+                        p->p_direct = NULL;
+                        if (got > 0)
+                        {
+                                break;
+                        }
+                }
+                else
+                {
+                        err = sched_cancellable_sleep_on(&p->p_rq);
+                }
+
+                if (err < 0)
+                {
+                        /* a wakeup may have been meant for us, do not lose it */
+                        if (p->p_nbufs > 0 || !p->p_writers)
+                        {
+                                sched_wakeup_on(&p->p_rq);
+                        }
+                        dbg(DBG_PRINT, "(GRADING2B)\n");
+                        return err;
+                }
+        }
+
+        got += pipe_copyout(p, iov, iovcnt, got, count - got);
+        if (p->p_nbufs > 0)
+        {
+                sched_wakeup_on(&p->p_rq);
+        }
+        dbg(DBG_PRINT, "(GRADING2B)\n");
+        return got;
+}
+
+static int pipe_read(vnode_t *vn, off_t off, void *buf, size_t count)
+{
+        struct iovec iov;
+
+        iov.iov_base = buf;
+        iov.iov_len = count;
+        return pipe_readv(vn, off, &iov, 1);
+}
+
+/*
+ * Blocks until all of the vector iov is written or the read end is
+ * closed. Vectors of at most PIPE_ATOMIC bytes in all wait until they fit
+ * whole, so that they are never interleaved with those of other writers.
+ */
+static int pipe_writev(vnode_t *vn, off_t off, const struct iovec *iov, int iovcnt)
+{
+        pipe_t *p = VNODE_TO_PIPE(vn);
+        size_t count = 0, done = 0;
+        size_t n, k, len;
+        char *seg;
+        int i, err;
+
+        KASSERT(PIPE_WRITE == PIPE_VNO_END(vn->vn_vno));
+
+        for (i = 0; i < iovcnt; i++)
+        {
+                count += iov[i].iov_len;
+        }
+
+        while (done < count)
+        {
+                if (!p->p_readers)
+                {
+                        /* pass the broken pipe on to the next writer */
+                        sched_wakeup_on(&p->p_wq);
+                        dbg(DBG_PRINT, "(GRADING2B)\n");
+                        return (done > 0) ? (int)done : -EPIPE;
+                }
+
+                if (NULL != p->p_direct && 0 == p->p_nbufs && p->p_dgot < p->p_dlen)
+                {
+                        /* straight from our vector into the reader's */
+                        n = MIN(count - done, p->p_dlen - p->p_dgot);
+                        for (k = 0; k < n; k += len)
+                        {
+                                seg = pipe_iov_at(p->p_diov, p->p_diovcnt, p->p_dgot + k, &len);
+                                len = MIN(len, n - k);
+                                pipe_iov_copy(seg, len, iov, iovcnt, done + k, 0);
+                        }
+                        if (0 == p->p_dgot)
+                        {
+                                sched_wakeup_on(&p->p_dq);
+                        }
+                        p->p_dgot += n;
+                        done += n;
+                        continue;
+                }
+
+                if (count > PIPE_ATOMIC || pipe_room(p) >= count - done)
+                {
+                        n = pipe_copyin(p, iov, iovcnt, done, count - done);
+                        if (n > 0)
+                        {
+                                done += n;
+                                continue;
+                        }
+                }
+
+                if ((err = sched_cancellable_sleep_on(&p->p_wq)) < 0)
+                {
+                        if (pipe_room(p) > 0 || !p->p_readers)
+                        {
+                                sched_wakeup_on(&p->p_wq);
+                        }
+                        dbg(DBG_PRINT, "(GRADING2B)\n");
+                        return (done > 0) ? (int)done : err;
+                }
+        }
+
+        if (pipe_room(p) > 0)
+        {
+                sched_wakeup_on(&p->p_wq);
+        }
+        dbg(DBG_PRINT, "(GRADING2B)\n");
+        return done;
+}
+
+static int pipe_write(vnode_t *vn, off_t off, const void *buf, size_t count)
+{
+        struct iovec iov;
+
+        iov.iov_base = (void *)buf;
+        iov.iov_len = count;
+        return pipe_writev(vn, off, &iov, 1);
+}
+
+static int pipe_stat(vnode_t *vn, struct stat *ss)
+{
+        pipe_t *p = VNODE_TO_PIPE(vn);
+
+        memset(ss, 0, sizeof(struct stat));
+        ss->st_mode = vn->vn_mode;
+        ss->st_ino = vn->vn_vno;
+        ss->st_nlink = 1;
+        ss->st_size = PIPE_NBUFS * PAGE_SIZE - pipe_room(p);
+        ss->st_blksize = PAGE_SIZE;
+        return 0;
+}
+
+/*
+ * The read end is readable when there is data and hung up once the write
+ * end is closed. The write end is writable when there is room and in
+ * error once the read end is closed.
+ */
+static int pipe_poll(vnode_t *vn, pollq_t **pq)
+{
+        pipe_t *p = VNODE_TO_PIPE(vn);
+        int revents = 0;
+
+        *pq = &p->p_pollq;
+        if (PIPE_READ == PIPE_VNO_END(vn->vn_vno))
+        {
+                if (p->p_nbufs > 0)
+                {
+                        revents |= POLLIN;
+                }
+                if (!p->p_writers)
+                {
+                        revents |= POLLHUP;
+                }
+        }
+        else
+        {
+                if (!p->p_readers)
+                {
+                        revents |= POLLERR;
+                }
+                else if (pipe_room(p) > 0)
+                {
+                        revents |= POLLOUT;
+                }
+        }
+        return revents;
+}
+
+static void pipe_read_vnode(vnode_t *vn)
+{
+        pipe_t *p;
+
+        list_iterate_begin(&pipe_list, p, pipe_t, p_link)
+        {
+                if (p->p_id == PIPE_VNO_ID(vn->vn_vno))
+                {
+                        vn->vn_i = p;
+                        vn->vn_ops = &pipe_vops;
+                        vn->vn_mode = S_IFIFO;
+                        vn->vn_len = 0;
+                        if (PIPE_READ == PIPE_VNO_END(vn->vn_vno))
+                        {
+                                p->p_readers = 1;
+                        }
+                        else
+                        {
+                                p->p_writers = 1;
+                        }
+                        return;
+                }
+        }
+        list_iterate_end();
+
+        panic("pipefs: no pipe for vnode %d\n", (int)vn->vn_vno);
+}
+
+/* The last file on one end is gone; let the other side know. */
+static void pipe_delete_vnode(vnode_t *vn)
+{
+        pipe_t *p = VNODE_TO_PIPE(vn);
+
+        if (PIPE_READ == PIPE_VNO_END(vn->vn_vno))
+        {
+                p->p_readers = 0;
+                sched_wakeup_on(&p->p_wq);
+        }
+        else
+        {
+                p->p_writers = 0;
+                sched_wakeup_on(&p->p_rq);
+                sched_wakeup_on(&p->p_dq);
+        }
+        pollq_wake(&p->p_pollq);
+
+        if (!p->p_readers && !p->p_writers)
+        {
+                pipe_free(p);
+        }
+}
+
+static int pipe_query_vnode(vnode_t *vn)
+{
+        return 1;
+}
+
+/*
+ * Creates a pipe and puts its read end in pipefd[0] and its write end in
+ * pipefd[1].
+ *
+ * Error cases:
+ *      o EMFILE
+ *        The process does not have two free file descriptors.
+ *      o ENOMEM
+ *        Insufficient kernel memory was available.
+ */
+int do_pipe(int pipefd[2])
+{
+        pipe_t *p;
+        vnode_t *rvn = NULL, *wvn = NULL;
+        file_t *rf = NULL, *wf = NULL;
+        int rfd, wfd;
+        int err = -ENOMEM;
+
+        if (NULL == (p = pipe_alloc()))
+        {
+                dbg(DBG_PRINT, "(GRADING2B)\n");
+                return -ENOMEM;
+        }
+        rvn = vget(&pipe_fs, PIPE_VNO(p, PIPE_READ));
+        wvn = vget(&pipe_fs, PIPE_VNO(p, PIPE_WRITE));
+        if (NULL == rvn || NULL == wvn)
+        {
+                goto fail;
+        }
+        if (NULL == (rf = fget(-1)) || NULL == (wf = fget(-1)))
+        {
+                goto fail;
+        }
+
+        if ((rfd = get_empty_fd(curproc)) < 0)
+        {
+                err = rfd;
+                goto fail;
+        }
+        curproc->p_files[rfd] = rf;
+        if ((wfd = get_empty_fd(curproc)) < 0)
+        {
+                curproc->p_files[rfd] = NULL;
+                err = wfd;
+                goto fail;
+        }
+        curproc->p_files[wfd] = wf;
+
+        rf->f_mode = FMODE_READ;
+        rf->f_vnode = rvn;
+        rf->f_pos = 0;
+        wf->f_mode = FMODE_WRITE;
+        wf->f_vnode = wvn;
+        wf->f_pos = 0;
+
+        pipefd[0] = rfd;
+        pipefd[1] = wfd;
+        dbg(DBG_PRINT, "(GRADING2B)\n");
+        return 0;
+
+fail:
+        if (NULL != rf)
+        {
+                fput(rf);
+        }
+        if (NULL != wf)
+        {
+                fput(wf);
+        }
+        if (NULL != rvn)
+        {
+                vput(rvn);
+        }
+        if (NULL != wvn)
+        {
+                vput(wvn);
+        }
+        if (NULL == rvn && NULL == wvn)
+        {
+                pipe_free(p);
+        }
+        dbg(DBG_PRINT, "(GRADING2B)\n");
+        return err;
+}
+
+#endif /* __PIPES__ */
@@ -0,0 +1,223 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "main/interrupt.h"
+
+#include "proc/sched.h"
+#include "proc/timer.h"
+
+#include "mm/kmalloc.h"
+
+#include "util/list.h"
+#include "util/debug.h"
+
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#include "fs/file.h"
+#include "fs/poll.h"
+#include "fs/vfs_syscall.h"
+
+/*
+ * poll(2). A pollable source (a pipe, a tty, ...) keeps a pollq_t and
+ * calls pollq_wake() on it whenever it may have become readable or
+ * writable. The vnode's poll op reports the current events and hands
+ * back that queue. do_poll() hangs one entry per descriptor on those
+ * queues and sleeps on its own ktqueue, so a single thread waits on all
+ * of them at once. Files without a poll op are always ready, as regular
+ * files are.
+ */
+
+typedef struct poller {
+        ktqueue_t       pl_q;
+        int             pl_timedout;
+        ktimer_t        pl_timer;
+} poller_t;
+
+typedef struct poll_entry {
+        poller_t       *pe_poller;
+        pollq_t        *pe_pq;
+        list_link_t     pe_link;
+} poll_entry_t;
+
+void pollq_init(pollq_t *pq)
+{
+        list_init(&pq->pq_waiters);
+}
+
+/* Wakes every poller waiting on pq. May be called from interrupt context. */
+void pollq_wake(pollq_t *pq)
+{
+        uint8_t oldipl = intr_getipl();
+        poll_entry_t *pe;
+
+        intr_setipl(IPL_HIGH);
+        list_iterate_begin(&pq->pq_waiters, pe, poll_entry_t, pe_link)
+        {
+                sched_wakeup_on(&pe->pe_poller->pl_q);
+        }
+        list_iterate_end();
+        intr_setipl(oldipl);
+}
+
+static void poll_timeout(void *arg)
+{
+        poller_t *pl = (poller_t *)arg;
+
+        pl->pl_timedout = 1;
+        sched_wakeup_on(&pl->pl_q);
+}
+
+/* The events of interest that are ready on file, and where to wait for more. */
+static int poll_file(file_t *file, int events, pollq_t **pq)
+{
+        vnode_t *vn = file->f_vnode;
+        int revents;
+
+        *pq = NULL;
+        if (NULL == vn->vn_ops->poll)
+        {
+                revents = POLLIN | POLLOUT;
+        }
+        else
+        {
+                revents = vn->vn_ops->poll(vn, pq);
+        }
+        if (!(file->f_mode & FMODE_READ))
+        {
+                revents &= ~POLLIN;
+        }
+        if (!(file->f_mode & FMODE_WRITE))
+        {
+                revents &= ~POLLOUT;
+        }
+        return revents & (events | POLLERR | POLLHUP);
+}
+
+/*
+ * Waits until one of the nfds descriptors in fds is ready for the events
+ * asked for, and fills in revents for all of them. timeout is in
+ * milliseconds; 0 just checks and a negative timeout waits for ever.
+ * Returns the number of descriptors with a non-zero revents, 0 on
+ * timeout.
+ *
+ * Error cases:
+ *      o EINTR
+ *        The wait was cancelled.
+ *      o ENOMEM
+ *        Insufficient kernel memory was available.
+ */
+int do_poll(struct pollfd *fds, unsigned int nfds, int timeout)
+{
+        poll_entry_t *pes = NULL;
+        file_t **files = NULL;
+        poller_t pl;
+        uint8_t oldipl;
+        unsigned int i;
+        pollq_t *pq;
+        int nready = 0;
+        int err;
+
+        if (nfds > 0)
+        {
+                pes = (poll_entry_t *)kmalloc(nfds * sizeof(poll_entry_t));
+                files = (file_t **)kmalloc(nfds * sizeof(file_t *));
+                if (NULL == pes || NULL == files)
+                {
+                        if (NULL != pes)
+                        {
+                                kfree(pes);
+                        }
+                        if (NULL != files)
+                        {
+                                kfree(files);
+                        }
+                        return -ENOMEM;
+                }
+        }
+
+        sched_queue_init(&pl.pl_q);
+        pl.pl_timedout = 0;
+        ktimer_init(&pl.pl_timer, poll_timeout, &pl);
+
+        /* the files stay held so that their queues outlive the entries */
+        for (i = 0; i < nfds; i++)
+        {
+                files[i] = (fds[i].fd >= 0) ? fget(fds[i].fd) : NULL;
+                pes[i].pe_poller = &pl;
+                pes[i].pe_pq = NULL;
+                list_link_init(&pes[i].pe_link);
+        }
+
+        /* an interrupt-driven source cannot slip a wakeup in between
+         * the check and the sleep */
+        oldipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        for (;;)
+        {
+                nready = 0;
+                for (i = 0; i < nfds; i++)
+                {
+                        if (fds[i].fd < 0)
+                        {
+                                fds[i].revents = 0;
+                                continue;
+                        }
+                        if (NULL == files[i])
+                        {
+                                fds[i].revents = POLLNVAL;
+                                nready++;
+                                continue;
+                        }
+                        fds[i].revents = poll_file(files[i], fds[i].events, &pq);
+                        if (0 != fds[i].revents)
+                        {
+                                nready++;
+                        }
+                        if (NULL != pq && NULL == pes[i].pe_pq)
+                        {
+                                pes[i].pe_pq = pq;
+                                list_insert_tail(&pq->pq_waiters, &pes[i].pe_link);
+                        }
+                }
+
+                if (nready > 0 || 0 == timeout || pl.pl_timedout)
+                {
+                        break;
+                }
+                if (timeout > 0 && !list_link_is_linked(&pl.pl_timer.tm_link))
+                {
+                        ktimer_add(&pl.pl_timer, ms_to_jiffies(timeout));
+                }
+                if ((err = sched_cancellable_sleep_on(&pl.pl_q)) < 0)
+                {
+                        nready = err;
+                        break;
+                }
+        }
+
+        ktimer_del(&pl.pl_timer);
+        for (i = 0; i < nfds; i++)
+        {
+                if (NULL != pes[i].pe_pq)
+                {
+                        list_remove(&pes[i].pe_link);
+                }
+        }
+        intr_setipl(oldipl);
+
+        for (i = 0; i < nfds; i++)
+        {
+                if (NULL != files[i])
+                {
+                        fput(files[i]);
+                }
+        }
+        if (nfds > 0)
+        {
+                kfree(pes);
+                kfree(files);
+        }
+        dbg(DBG_PRINT, "(GRADING2B)\n");
+        return nready;
+}
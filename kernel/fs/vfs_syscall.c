@@ -4,11 +4,14 @@
 #include "fs/vfs.h"
 #include "fs/file.h"
 #include "fs/vnode.h"
+#include "fs/dcache.h"
 #include "fs/vfs_syscall.h"
 #include "fs/open.h"
 #include "fs/fcntl.h"
 #include "fs/lseek.h"
 #include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
 #include "util/string.h"
 #include "util/printf.h"
 #include "fs/stat.h"
@@ -20,6 +23,128 @@
  * negative error code.
  */
 
+/*
+ * file_rw() for pipes and ttys, which hand back whatever they have and
+ * block for more. A vnode with readv/writev ops (pipes) takes the whole
+ * vector in one call. Writes to the others go a buffer at a time, but a
+ * read has to be a single call, or it would block for more once the
+ * first buffer is full; so a read goes through a page, and returns at
+ * most a page.
+ */
+static int stream_rw(vnode_t *vn, const struct iovec *iov, int iovcnt,
+                     off_t pos, int write)
+{
+        char *buf;
+        size_t len = 0, done, c;
+        int total = 0, n = 0, i;
+
+        if (write ? NULL != vn->vn_ops->writev : NULL != vn->vn_ops->readv)
+        {
+                n = write ? vn->vn_ops->writev(vn, pos, iov, iovcnt)
+                          : vn->vn_ops->readv(vn, pos, iov, iovcnt);
+                if (write && n > 0)
+                {
+                        vn->vn_statvalid = 0;
+                }
+                return n;
+        }
+        if (write)
+        {
+                for (i = 0; i < iovcnt; i++)
+                {
+                        if (0 == iov[i].iov_len)
+                        {
+                                continue;
+                        }
+                        n = vn->vn_ops->write(vn, pos, iov[i].iov_base, iov[i].iov_len);
+                        if (n <= 0)
+                        {
+                                break;
+                        }
+                        pos += n;
+                        total += n;
+                        vn->vn_statvalid = 0;
+                        if ((size_t)n < iov[i].iov_len)
+                        {
+                                break;
+                        }
+                }
+                return (0 == total && n < 0) ? n : total;
+        }
+
+        for (i = 0; i < iovcnt && len < PAGE_SIZE; i++)
+        {
+                len += MIN(iov[i].iov_len, PAGE_SIZE - len);
+        }
+        if (0 == len)
+        {
+                return 0;
+        }
+        if (NULL == (buf = (char *)page_alloc()))
+        {
+                return -ENOMEM;
+        }
+        if ((n = vn->vn_ops->read(vn, pos, buf, len)) > 0)
+        {
+                for (i = 0, done = 0; done < (size_t)n; i++)
+                {
+                        c = MIN(iov[i].iov_len, n - done);
+                        memcpy(iov[i].iov_base, buf + done, c);
+                        done += c;
+                }
+        }
+        page_free(buf);
+        return n;
+}
+
+/*
+ * Moves data between file, starting at offset pos, and the iovcnt kernel
+ * buffers of iov in order: into them if write is 0, out of them
+ * otherwise. The vnode's read/write op is called once per buffer, and a
+ * short transfer ends the vector early; pipes and ttys go through
+ * stream_rw() instead. f_pos is left to the caller. Returns the number of
+ * bytes moved, or the error of the first buffer if nothing was.
+ */
+static int file_rw(file_t *file, const struct iovec *iov, int iovcnt,
+                   off_t pos, int write)
+{
+        vnode_t *vn = file->f_vnode;
+        int total = 0;
+        int n, i;
+
+        if (iovcnt > 1 && !S_ISREG(vn->vn_mode) && !S_ISDIR(vn->vn_mode))
+        {
+                return stream_rw(vn, iov, iovcnt, pos, write);
+        }
+        for (i = 0; i < iovcnt; i++)
+        {
+                n = write ? vn->vn_ops->write(vn, pos, iov[i].iov_base, iov[i].iov_len)
+                          : vn->vn_ops->read(vn, pos, iov[i].iov_base, iov[i].iov_len);
+                if (n < 0)
+                {
+                        if (total == 0)
+                        {
+                                dbg(DBG_PRINT, "(GRADING2B)\n");
+                                return n;
+                        }
+                        break;
+                }
+                pos += n;
+                total += n;
+                if (write && n > 0)
+                {
+                        vn->vn_statvalid = 0;
+                }
+                if ((size_t)n < iov[i].iov_len)
+                {
+                        dbg(DBG_PRINT, "(GRADING2B)\n");
+                        break;
+                }
+        }
+        dbg(DBG_PRINT, "(GRADING2B)\n");
+        return total;
+}
+
 /* To read a file:
  *      o fget(fd)
  *      o call its virtual read vn_op
@@ -39,14 +164,31 @@
 int do_read(int fd, void *buf, size_t nbytes)
 {
         // NOT_YET_IMPLEMENTED("VFS: do_read");
+        struct iovec iov = { .iov_base = buf, .iov_len = nbytes };
+
+        return do_readv(fd, &iov, 1);
+}
+
+/*
+ * readv(2): do_read() scattering into the iovcnt kernel buffers of iov.
+ * The file is looked up and checked once and its position updated once
+ * for the whole vector (see file_rw()).
+ */
+int do_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+        return do_preadv(fd, iov, iovcnt, -1);
+}
+
+/*
+ * pread(2)/preadv(2): do_readv() starting at offset off and leaving f_pos
+ * alone, so that readers sharing an open file do not have to seek and do
+ * not disturb each other. An off of -1 stands for the current position,
+ * which is then advanced as do_readv() does.
+ */
+int do_preadv(int fd, const struct iovec *iov, int iovcnt, off_t off)
+{
         file_t *file = fget(fd);
 
-        // if (nbytes == 0) // if nbytes is 0, return 0
-        // {
-        //         fput(file);
-        //         dbg(DBG_PRINT, "(GRADING2B)\n");
-        //         return 0;
-        // }
         if (file == NULL) // if file is NULL, return -EBADF
         {
                 dbg(DBG_PRINT, "(GRADING2B)\n");
@@ -66,15 +208,20 @@ int do_read(int fd, void *buf, size_t nbytes)
 
                 return -EBADF;
         }
+        if (off != -1 && S_ISFIFO(file->f_vnode->vn_mode)) // pipes have no offsets
+        {
+                fput(file);
+                return -ESPIPE;
+        }
 
-        // call its virtual read vn_op
-        int bytes_read = file->f_vnode->vn_ops->read(file->f_vnode, file->f_pos, buf, nbytes);
-
-        if (bytes_read >= 0) // if bytes_read is greater than or equal to 0, update f_pos
+        // call its virtual read vn_op for each buffer and update f_pos
+        int bytes_read = file_rw(file, iov, iovcnt, (off == -1) ? file->f_pos : off, 0);
+        if (bytes_read > 0 && off == -1)
         {
                 file->f_pos += bytes_read;
                 dbg(DBG_PRINT, "(GRADING2B)\n");
         }
+
         fput(file); // fput() it
         dbg(DBG_PRINT, "(GRADING2B)\n");
         return bytes_read; // return the number of bytes read, or an error
@@ -91,6 +238,28 @@ int do_read(int fd, void *buf, size_t nbytes)
 int do_write(int fd, const void *buf, size_t nbytes)
 {
         // NOT_YET_IMPLEMENTED("VFS: do_write");
+        struct iovec iov = { .iov_base = (void *)buf, .iov_len = nbytes };
+
+        return do_writev(fd, &iov, 1);
+}
+
+/*
+ * writev(2): do_write() gathering from the iovcnt kernel buffers of iov.
+ * An append seeks to the end once, before the first buffer, so the
+ * vector lands in the file contiguously.
+ */
+int do_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+        return do_pwritev(fd, iov, iovcnt, -1);
+}
+
+/*
+ * pwrite(2)/pwritev(2): do_writev() at offset off, leaving f_pos alone.
+ * An explicit offset is honored even for files opened for appending. An
+ * off of -1 stands for the current position, as in do_preadv().
+ */
+int do_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t off)
+{
         file_t *file = fget(fd);
         if (file == NULL) // if file is NULL, return -EBADF
         {
@@ -104,20 +273,28 @@ int do_write(int fd, const void *buf, size_t nbytes)
                 dbg(DBG_PRINT, "(GRADING2B)\n");
                 return -EBADF;
         }
+        if (off != -1 && S_ISFIFO(file->f_vnode->vn_mode)) // pipes have no offsets
+        {
+                fput(file);
+                return -ESPIPE;
+        }
 
         // check
-        if (file->f_mode & FMODE_APPEND) // if f_mode & FMODE_APPEND, do_lseek() to the end of the file
+        if ((file->f_mode & FMODE_APPEND) && off == -1) // if f_mode & FMODE_APPEND, do_lseek() to the end of the file
         {
                 dbg(DBG_PRINT, "(GRADING2B)\n");
                 do_lseek(fd, 0, SEEK_END);
         }
-        int bytes_written = file->f_vnode->vn_ops->write(file->f_vnode, file->f_pos, buf, nbytes);
+        int bytes_written = file_rw(file, iov, iovcnt, (off == -1) ? file->f_pos : off, 1);
         if (bytes_written >= 0) // if bytes_written is greater than or equal to 0, update f_pos
         {
-
-                file->f_pos += bytes_written;
+                if (off == -1)
+                {
+                        file->f_pos += bytes_written;
+                }
                 KASSERT((S_ISCHR(file->f_vnode->vn_mode)) ||
                         (S_ISBLK(file->f_vnode->vn_mode)) ||
+                        (S_ISFIFO(file->f_vnode->vn_mode)) ||
                         ((S_ISREG(file->f_vnode->vn_mode)) && (file->f_pos <= file->f_vnode->vn_len)));
                 dbg(DBG_PRINT, "(GRADING2A 3.a)\n");
                 dbg(DBG_PRINT, "(GRADING2B)\n");
@@ -127,6 +304,190 @@ int do_write(int fd, const void *buf, size_t nbytes)
         return bytes_written;
 }
 
+/*
+ * Finds the first extent of vn with data in it that ends after pos, and
+ * returns it as [*start, *end). File systems that know which blocks are
+ * allocated answer through the extent vn_op; for the rest the whole file
+ * is one extent, as POSIX allows. Returns -ENXIO if there is no data
+ * after pos.
+ */
+static int vn_extent(vnode_t *vn, off_t pos, off_t *start, off_t *end)
+{
+        int res;
+
+        if (pos >= vn->vn_len)
+        {
+                return -ENXIO;
+        }
+        if (NULL == vn->vn_ops->extent)
+        {
+                *start = 0;
+                *end = vn->vn_len;
+                return 0;
+        }
+        if ((res = vn->vn_ops->extent(vn, pos, start, end)) < 0)
+        {
+                return res;
+        }
+        *end = MIN(*end, vn->vn_len);
+        return (*start < *end) ? 0 : -ENXIO;
+}
+
+/*
+ * sendfile(2): copies up to count bytes of the regular file in_fd to
+ * out_fd inside the kernel. The source pages are taken from in_fd's page
+ * cache with pframe_get() and handed from pf_addr straight to out_fd's
+ * write op, so the data is copied once and never passes through a user
+ * buffer. out_fd can be anything writable: another file, a tty, null.
+ *
+ * Reading starts at *off, which is advanced past the data sent, or at
+ * in_fd's position (advanced instead) if off is NULL. out_fd's position
+ * advances as with do_write(). Returns the number of bytes sent, or an
+ * error if nothing was.
+ *
+ * Holes in in_fd (see vn_extent()) are not read. When out_fd is a regular
+ * file being written past its end they are not written either: its
+ * position just moves on, leaving a hole, and a final byte is written if
+ * the copy ends in a hole it skipped so that the length comes out right.
+ *
+ * Error cases:
+ *      o EBADF
+ *        in_fd is not open for reading or out_fd is not open for writing.
+ *      o EINVAL
+ *        in_fd is not a regular file, or *off is negative.
+ */
+int do_sendfile(int out_fd, int in_fd, off_t *off, size_t count)
+{
+        file_t *in, *out;
+        vnode_t *vn, *outvn;
+        pframe_t *pf;
+        off_t pos;
+        off_t dstart = 0, dend = 0;     /* the input's current data extent */
+        size_t done = 0;
+        size_t skipped = 0;             /* hole skipped since the last write */
+        size_t n;
+        char zero = 0;
+        int err = 0;
+        int res;
+
+        if (NULL == (in = fget(in_fd)))
+        {
+                dbg(DBG_PRINT, "(GRADING2B)\n");
+                return -EBADF;
+        }
+        if (NULL == (out = fget(out_fd)))
+        {
+                fput(in);
+                dbg(DBG_PRINT, "(GRADING2B)\n");
+                return -EBADF;
+        }
+        if (!(in->f_mode & FMODE_READ) || !(out->f_mode & FMODE_WRITE))
+        {
+                err = -EBADF;
+                goto out;
+        }
+        vn = in->f_vnode;
+        outvn = out->f_vnode;
+        if (!S_ISREG(vn->vn_mode) || (NULL != off && *off < 0))
+        {
+                err = -EINVAL;
+                goto out;
+        }
+
+        if (out->f_mode & FMODE_APPEND)
+        {
+                do_lseek(out_fd, 0, SEEK_END);
+        }
+
+        pos = (NULL != off) ? *off : in->f_pos;
+        while (done < count && pos < vn->vn_len)
+        {
+                if (pos >= dend)
+                {
+                        if ((err = vn_extent(vn, pos, &dstart, &dend)) == -ENXIO)
+                        {
+                                dstart = dend = vn->vn_len;
+                        }
+                        else if (err < 0)
+                        {
+                                break;
+                        }
+                }
+                if (pos < dstart && S_ISREG(outvn->vn_mode) && out->f_pos >= outvn->vn_len)
+                {
+                        n = MIN(count - done, (size_t)(dstart - pos));
+                        out->f_pos += n;
+                        pos += n;
+                        done += n;
+                        skipped += n;
+                        continue;
+                }
+
+                n = MIN(count - done, PAGE_SIZE - PAGE_OFFSET(pos));
+                n = MIN(n, (size_t)(vn->vn_len - pos));
+
+                if ((err = pframe_get(&vn->vn_mmobj, ADDR_TO_PN(pos), &pf)) < 0)
+                {
+                        break;
+                }
+                /* the write may block, and must not lose the page meanwhile */
+                pframe_pin(pf);
+                err = outvn->vn_ops->write(outvn, out->f_pos,
+                                           (char *)pf->pf_addr + PAGE_OFFSET(pos), n);
+                pframe_unpin(pf);
+                if (err < 0)
+                {
+                        break;
+                }
+
+                outvn->vn_statvalid = 0;
+                out->f_pos += err;
+                pos += err;
+                done += err;
+                if (err > 0)
+                {
+                        skipped = 0;
+                }
+                if ((size_t)err < n)
+                {
+                        break;
+                }
+        }
+
+        /* a hole this call skipped at the end still has to make the file
+         * longer; if it cannot, the hole was not sent */
+        if (skipped > 0 && out->f_pos > outvn->vn_len)
+        {
+                if ((res = outvn->vn_ops->write(outvn, out->f_pos - 1, &zero, 1)) < 0)
+                {
+                        out->f_pos -= skipped;
+                        pos -= skipped;
+                        done -= skipped;
+                        err = res;
+                }
+                outvn->vn_statvalid = 0;
+        }
+
+        if (NULL != off)
+        {
+                *off = pos;
+        }
+        else
+        {
+                in->f_pos = pos;
+        }
+        if (done > 0)
+        {
+                err = done;
+        }
+        dbg(DBG_PRINT, "(GRADING2B)\n");
+
+out:
+        fput(out);
+        fput(in);
+        return err;
+}
+
 /*
  * Zero curproc->p_files[fd], and fput() the file. Return 0 on success
  *
@@ -293,6 +654,8 @@ int do_mknod(const char *path, int mode, unsigned devid)
         KASSERT(NULL != dir_vnode->vn_ops->mknod);
         dbg(DBG_PRINT, "(GRADING2A 3.b)\n");
         res = dir_vnode->vn_ops->mknod(dir_vnode, name, namelen, mode, devid);
+        dcache_invalidate(dir_vnode, name, namelen);
+        dir_vnode->vn_statvalid = 0;
         vput(dir_vnode); // vput() the dir_vnode, decrement its refcount
 
         dbg(DBG_PRINT, "(GRADING2B)\n");
@@ -349,6 +712,8 @@ int do_mkdir(const char *path)
         KASSERT(NULL != dir_vnode->vn_ops->mkdir);
         dbg(DBG_PRINT, "(GRADING2A 3.c)\n");
         res = dir_vnode->vn_ops->mkdir(dir_vnode, name, namelen);
+        dcache_invalidate(dir_vnode, name, namelen);
+        dir_vnode->vn_statvalid = 0;
         vput(dir_vnode); // vput() the dir_vnode, decrement its refcount
 
         dbg(DBG_PRINT, "(GRADING2B)\n");
@@ -401,9 +766,28 @@ int do_rmdir(const char *path)
                 dbg(DBG_PRINT, "(GRADING2B)\n");
                 return -ENOTEMPTY;
         }
+        // the cache has to forget the directory's own entries too
+        vnode_t *vnode = NULL;
+        fs_t *fs = NULL;
+        ino_t vno = 0;
+        if (0 == lookup(dir_vnode, name, namelen, &vnode))
+        {
+                fs = vnode->vn_fs;
+                vno = vnode->vn_vno;
+                vput(vnode);
+        }
         KASSERT(NULL != dir_vnode->vn_ops->rmdir);
         dbg(DBG_PRINT, "(GRADING2A 3.d)\n");
         res = dir_vnode->vn_ops->rmdir(dir_vnode, name, namelen);
+        if (0 == res)
+        {
+                dir_vnode->vn_statvalid = 0;
+                dcache_enter(dir_vnode, name, namelen, NULL);
+                if (NULL != fs)
+                {
+                        dcache_purge_dir(fs, vno);
+                }
+        }
         vput(dir_vnode); // vput() the dir_vnode, decrement its refcount
         dbg(DBG_PRINT, "(GRADING2B)\n");
         return res;
@@ -455,6 +839,16 @@ int do_unlink(const char *path)
         KASSERT(NULL != dir_vnode->vn_ops->unlink);
         dbg(DBG_PRINT, "(GRADING2A 3.e)\n");
         res = dir_vnode->vn_ops->unlink(dir_vnode, name, namelen);
+        if (0 == res)
+        {
+                dcache_enter(dir_vnode, name, namelen, NULL);
+        }
+        else
+        {
+                dcache_invalidate(dir_vnode, name, namelen);
+        }
+        dir_vnode->vn_statvalid = 0;
+        vnode->vn_statvalid = 0;
 
         vput(dir_vnode); // vput() the dir_vnode, decrement its refcount
         vput(vnode);     // vput() the vnode, decrement its refcount
@@ -507,6 +901,9 @@ int do_link(const char *from, const char *to)
         vnode_t *to_vnode = NULL;
         res = lookup(to_parent_vnode, name, namelen, &to_vnode); // if success, refcount of to_vnode will be incremented
         res = to_parent_vnode->vn_ops->link(from_vnode, to_parent_vnode, name, namelen);
+        dcache_invalidate(to_parent_vnode, name, namelen);
+        to_parent_vnode->vn_statvalid = 0;
+        from_vnode->vn_statvalid = 0;
         vput(from_vnode);      // vput() the from_vnode, decrement its refcount
         vput(to_parent_vnode); // vput() the to_parent_vnode, decrement its refcount
         dbg(DBG_PRINT, "(GRADING2B)\n");
@@ -628,6 +1025,76 @@ int do_getdent(int fd, struct dirent *dirp)
         return sizeof(*dirp);
 }
 
+/*
+ * Fills dirps, count bytes long, with as many of fd's directory entries
+ * as fit, starting at the file's f_pos, and advances f_pos past them.
+ * Returns the number of bytes filled, 0 at the end of the directory.
+ *
+ * If the vnode has a readdir_batch op the file system fills the buffer in
+ * one pass over the directory; otherwise readdir is called once per
+ * entry, but still under a single fget().
+ *
+ * Error cases:
+ *      o EBADF
+ *        Invalid file descriptor fd.
+ *      o ENOTDIR
+ *        File descriptor does not refer to a directory.
+ *      o EINVAL
+ *        dirps cannot hold even one entry.
+ */
+int do_getdents(int fd, struct dirent *dirps, size_t count)
+{
+        size_t max = count / sizeof(*dirps);
+        file_t *file;
+        vnode_t *vn;
+        size_t n = 0;
+        int res;
+
+        if (fd < 0 || fd >= NFILES || NULL == (file = fget(fd)))
+        {
+                dbg(DBG_PRINT, "(GRADING2B)\n");
+                return -EBADF;
+        }
+        vn = file->f_vnode;
+        if (NULL == vn->vn_ops->readdir)
+        {
+                fput(file);
+                dbg(DBG_PRINT, "(GRADING2B)\n");
+                return -ENOTDIR;
+        }
+        if (0 == max)
+        {
+                fput(file);
+                return -EINVAL;
+        }
+
+        if (NULL != vn->vn_ops->readdir_batch)
+        {
+                res = vn->vn_ops->readdir_batch(vn, &file->f_pos, dirps, max);
+                if (res > 0)
+                {
+                        n = res;
+                }
+        }
+        else
+        {
+                while (n < max && (res = vn->vn_ops->readdir(vn, file->f_pos, &dirps[n])) > 0)
+                {
+                        file->f_pos += res;
+                        n++;
+                }
+        }
+        fput(file);
+
+        /* an error after some entries were read is reported next time */
+        if (0 == n && res < 0)
+        {
+                return res;
+        }
+        dbg(DBG_PRINT, "(GRADING2B)\n");
+        return n * sizeof(*dirps);
+}
+
 /*
  * Modify f_pos according to offset and whence.
  *
@@ -635,8 +1102,17 @@ int do_getdent(int fd, struct dirent *dirp)
  *      o EBADF
  *        fd is not an open file descriptor.
  *      o EINVAL
- *        whence is not one of SEEK_SET, SEEK_CUR, SEEK_END; or the resulting
- *        file offset would be negative.
+ *        whence is not one of SEEK_SET, SEEK_CUR, SEEK_END, SEEK_DATA,
+ *        SEEK_HOLE; or the resulting file offset would be negative.
+ *      o ENXIO
+ *        whence is SEEK_DATA or SEEK_HOLE and offset is at or past the end
+ *        of the file, or, for SEEK_DATA, there is no data after it.
+ *      o ESPIPE
+ *        fd refers to a pipe.
+ *
+ * SEEK_DATA moves to the first byte of data at or after offset and
+ * SEEK_HOLE to the first byte of a hole, the end of the file counting as
+ * one (see vn_extent()).
  */
 int do_lseek(int fd, int offset, int whence)
 {
@@ -653,6 +1129,13 @@ int do_lseek(int fd, int offset, int whence)
                 dbg(DBG_PRINT, "(GRADING2B)\n");
                 return -EBADF;
         }
+        if (S_ISFIFO(file->f_vnode->vn_mode)) // pipes cannot seek
+        {
+                fput(file);
+                return -ESPIPE;
+        }
+        off_t start, end;
+        int res;
         int new_pos = 0;
         switch (whence)
         {
@@ -668,6 +1151,42 @@ int do_lseek(int fd, int offset, int whence)
                 new_pos = file->f_vnode->vn_len + offset;
                 dbg(DBG_PRINT, "(GRADING2B)\n");
                 break;
+        case SEEK_DATA:
+                new_pos = offset;
+                if (offset < 0)
+                {
+                        break;
+                }
+                if ((res = vn_extent(file->f_vnode, offset, &start, &end)) < 0)
+                {
+                        fput(file);
+                        return res;
+                }
+                new_pos = MAX(offset, start);
+                break;
+        case SEEK_HOLE:
+                new_pos = offset;
+                if (offset < 0)
+                {
+                        break;
+                }
+                if (offset >= file->f_vnode->vn_len)
+                {
+                        fput(file);
+                        return -ENXIO;
+                }
+                /* past back-to-back extents to the hole after them */
+                while (0 == (res = vn_extent(file->f_vnode, new_pos, &start, &end)) &&
+                       start <= new_pos)
+                {
+                        new_pos = end;
+                }
+                if (res < 0 && -ENXIO != res)
+                {
+                        fput(file);
+                        return res;
+                }
+                break;
         default:
                 fput(file); // fput() the file, decrement its refcount
                 dbg(DBG_PRINT, "(GRADING2B)\n");
@@ -685,6 +1204,37 @@ int do_lseek(int fd, int offset, int whence)
         return new_pos;
 }
 
+/*
+ * Fills buf with vn's attributes. Those of regular files and directories
+ * only change through this file and open_namev(), which clear
+ * vn_statvalid when they do, so a copy is kept on the vnode and the
+ * stat() vnode operation is only called again after a change. The op may
+ * block; a change made meanwhile leaves vn_statvalid at 0 rather than -1,
+ * and the result is not kept.
+ */
+static int vn_getstat(vnode_t *vn, struct stat *buf)
+{
+        int res;
+
+        if (vn->vn_statvalid > 0)
+        {
+                memcpy(buf, &vn->vn_stat, sizeof(struct stat));
+                return 0;
+        }
+        KASSERT(NULL != vn->vn_ops->stat);
+        vn->vn_statvalid = -1;
+        if ((res = vn->vn_ops->stat(vn, buf)) < 0)
+        {
+                return res;
+        }
+        if (-1 == vn->vn_statvalid && (S_ISREG(vn->vn_mode) || S_ISDIR(vn->vn_mode)))
+        {
+                memcpy(&vn->vn_stat, buf, sizeof(struct stat));
+                vn->vn_statvalid = 1;
+        }
+        return 0;
+}
+
 /*
  * Find the vnode associated with the path, and call the stat() vnode operation.
  *
@@ -716,12 +1266,90 @@ int do_stat(const char *path, struct stat *buf)
         }
         KASSERT(NULL != vnode->vn_ops->stat);
         dbg(DBG_PRINT, "(GRADING2A 3.f)\n");
-        res = vnode->vn_ops->stat(vnode, buf);
+        res = vn_getstat(vnode, buf);
         vput(vnode); // vput() the vnode, decrement its refcount
         dbg(DBG_PRINT, "(GRADING2B)\n");
         return res;
 }
 
+/*
+ * Like do_stat(), but for the file open on fd.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor.
+ */
+int do_fstat(int fd, struct stat *buf)
+{
+        file_t *file;
+        int res;
+
+        if (fd < 0 || fd >= NFILES || NULL == (file = fget(fd)))
+        {
+                dbg(DBG_PRINT, "(GRADING2B)\n");
+                return -EBADF;
+        }
+        res = vn_getstat(file->f_vnode, buf);
+        fput(file);
+        dbg(DBG_PRINT, "(GRADING2B)\n");
+        return res;
+}
+
+/*
+ * Writes out fd's dirty pages, in order, and then has the file system
+ * write out its inode if it can (the fs_op fsync_vnode); nothing else's
+ * dirty data is touched, unlike sync(2). With datasync set the file
+ * system may skip metadata that is not needed to read the data back.
+ */
+static int vfs_fsync(int fd, int datasync)
+{
+        file_t *file;
+        vnode_t *vn;
+        int res, err;
+
+        if (fd < 0 || fd >= NFILES || NULL == (file = fget(fd)))
+        {
+                dbg(DBG_PRINT, "(GRADING2B)\n");
+                return -EBADF;
+        }
+        vn = file->f_vnode;
+        if (!S_ISREG(vn->vn_mode) && !S_ISDIR(vn->vn_mode))
+        {
+                fput(file);
+                return -EINVAL;
+        }
+
+        res = pframe_clean_obj(&vn->vn_mmobj);
+        if (NULL != vn->vn_fs->fs_op->fsync_vnode &&
+            (err = vn->vn_fs->fs_op->fsync_vnode(vn, datasync)) < 0 && 0 == res)
+        {
+                res = err;
+        }
+        fput(file);
+        dbg(DBG_PRINT, "(GRADING2B)\n");
+        return res;
+}
+
+/*
+ * Makes the file open on fd, data and inode, durable.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor.
+ *      o EINVAL
+ *        fd refers to a pipe or device, which cannot be synced.
+ */
+int do_fsync(int fd)
+{
+        return vfs_fsync(fd, 0);
+}
+
+/* Like do_fsync(), but the inode only as far as the data needs it. */
+int do_fdatasync(int fd)
+{
+        return vfs_fsync(fd, 1);
+}
+
 #ifdef __MOUNTING__
 /*
  * Implementing this function is not required and strongly discouraged unless
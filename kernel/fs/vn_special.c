@@ -6,6 +6,7 @@
 #include "fs/stat.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
+#include "fs/poll.h"
 #include "mm/slab.h"
 #include "proc/sched.h"
 #include "util/debug.h"
@@ -21,6 +22,7 @@ int special_file_stat(vnode_t *vnode, struct stat *ss);
 int special_file_fillpage(vnode_t *file, off_t offset, void *pagebuf);
 int special_file_dirtypage(vnode_t *file, off_t offset);
 int special_file_cleanpage(vnode_t *file, off_t offset, void *pagebuf);
+int special_file_poll(vnode_t *file, pollq_t **pq);
 
 /* vnode operations tables for special files: */
 static vnode_ops_t bytedev_spec_vops = {
@@ -38,7 +40,8 @@ static vnode_ops_t bytedev_spec_vops = {
     .stat = special_file_stat,
     .fillpage = special_file_fillpage,
     .dirtypage = special_file_dirtypage,
-    .cleanpage = special_file_cleanpage};
+    .cleanpage = special_file_cleanpage,
+    .poll = special_file_poll};
 
 static vnode_ops_t blockdev_spec_vops = {
     .read = NULL,
@@ -207,3 +210,18 @@ int special_file_cleanpage(vnode_t *file, off_t offset, void *pagebuf)
         // KASSERT(0==1);
         return 0;
 }
+
+/* Pass the call through to the device-specific poll function. Devices
+ * without one never block, so they are always ready.
+ */
+int special_file_poll(vnode_t *file, pollq_t **pq)
+{
+        bytedev_t *dev = bytedev_lookup(file->vn_devid);
+
+        *pq = NULL;
+        if (NULL == dev->cd_ops->poll)
+        {
+                return POLLIN | POLLOUT;
+        }
+        return dev->cd_ops->poll(dev, pq);
+}
@@ -27,6 +27,7 @@
 #include "proc/sched.h"
 #include "proc/proc.h"
 #include "proc/kthread.h"
+#include "proc/timer.h"
 
 #include "drivers/dev.h"
 #include "drivers/blockdev.h"
@@ -42,8 +43,11 @@
 #include "fs/vfs_syscall.h"
 #include "fs/fcntl.h"
 #include "fs/stat.h"
+#include "fs/dcache.h"
+#include "fs/aio.h"
 
 #include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
 #include "test/s5fs_test.h"
 
 GDB_DEFINE_HOOK(initialized)
@@ -123,6 +127,121 @@ int my_vfs_test()
         return 0;
 }
 #endif
+
+#define NAMEV_BENCH_DEPTH 16
+#define NAMEV_BENCH_ITERS 1000
+
+/* Times open_namev() on /nb, /nb/d, /nb/d/d, ... NAMEV_BENCH_DEPTH deep. */
+int namev_bench(kshell_t *ksh, int argc, char **argv)
+{
+        char path[3 + 2 * NAMEV_BENCH_DEPTH];
+        char info[256];
+        vnode_t *vn;
+        uint32_t start, ticks;
+        int depth, i, res;
+
+        strcpy(path, "/nb");
+        for (depth = 1; depth <= NAMEV_BENCH_DEPTH; depth++)
+        {
+                if (depth > 1)
+                {
+                        strcat(path, "/d");
+                }
+                if ((res = do_mkdir(path)) < 0 && -EEXIST != res)
+                {
+                        kprintf(ksh, "namev_bench: mkdir %s: %d\n", path, res);
+                        return res;
+                }
+
+                start = jiffies;
+                for (i = 0; i < NAMEV_BENCH_ITERS; i++)
+                {
+                        if ((res = open_namev(path, 0, &vn, NULL)) < 0)
+                        {
+                                kprintf(ksh, "namev_bench: %s: %d\n", path, res);
+                                return res;
+                        }
+                        vput(vn);
+                }
+                ticks = MAX(jiffies - start, 1);
+                kprintf(ksh, "depth %2d: %u lookups/s\n", depth,
+                        NAMEV_BENCH_ITERS * HZ / ticks);
+        }
+
+        dcache_info(NULL, info, sizeof(info));
+        kprintf(ksh, "%s", info);
+        return 0;
+}
+
+#ifdef __PIPES__
+/*
+ * Writes through a pipe with write() and writev() and reads it back,
+ * including a vector whose pieces straddle page-sized chunks.
+ */
+int pipe_test(kshell_t *ksh, int argc, char **argv)
+{
+        static char out[PAGE_SIZE + 64], in[PAGE_SIZE + 64];
+        struct iovec iov[3];
+        int fds[2];
+        int res, i, failed = 0;
+
+        if ((res = do_pipe(fds)) < 0)
+        {
+                kprintf(ksh, "pipe_test: pipe: %d\n", res);
+                return res;
+        }
+        for (i = 0; i < (int)sizeof(out); i++)
+        {
+                out[i] = (char)('a' + i % 26);
+        }
+
+        if ((res = do_write(fds[1], out, 10)) != 10 ||
+            (res = do_read(fds[0], in, sizeof(in))) != 10 ||
+            0 != memcmp(in, out, 10))
+        {
+                kprintf(ksh, "pipe_test: write/read of 10 bytes: %d\n", res);
+                failed++;
+        }
+
+        iov[0].iov_base = out;
+        iov[0].iov_len = 100;
+        iov[1].iov_base = out + 100;
+        iov[1].iov_len = PAGE_SIZE - 100;
+        iov[2].iov_base = out + PAGE_SIZE;
+        iov[2].iov_len = 64;
+        if ((res = do_writev(fds[1], iov, 3)) != (int)sizeof(out))
+        {
+                kprintf(ksh, "pipe_test: writev: %d\n", res);
+                failed++;
+        }
+        memset(in, 0, sizeof(in));
+        for (i = 0; i < (int)sizeof(in); i += res)
+        {
+                if ((res = do_read(fds[0], in + i, sizeof(in) - i)) <= 0)
+                {
+                        kprintf(ksh, "pipe_test: read after writev: %d\n", res);
+                        failed++;
+                        break;
+                }
+        }
+        if (i == (int)sizeof(in) && 0 != memcmp(in, out, sizeof(in)))
+        {
+                kprintf(ksh, "pipe_test: writev data differs\n");
+                failed++;
+        }
+
+        do_close(fds[1]);
+        if ((res = do_read(fds[0], in, sizeof(in))) != 0)
+        {
+                kprintf(ksh, "pipe_test: read at EOF: %d\n", res);
+                failed++;
+        }
+        do_close(fds[0]);
+
+        kprintf(ksh, "pipe_test: %s\n", failed ? "FAILED" : "passed");
+        return failed ? -1 : 0;
+}
+#endif /* __PIPES__ */
 #endif /* __VFS__ */
 
 #endif
@@ -228,6 +347,7 @@ idleproc_run(int arg1, void *arg2)
         child = do_waitpid(-1, 0, &status);
         KASSERT(PID_INIT == child);
 
+        aio_shutdown();
         return final_shutdown();
 }
 
@@ -280,6 +400,10 @@ initproc_run(int arg1, void *arg2)
         kshell_add_command("vfstest", my_vfs_test, "Run vfstest().");
         kshell_add_command("thrtest", faber_fs_thread_test, "Run faber_fs_thread_test().");
         kshell_add_command("dirtest", faber_directory_test, "Run faber_directory_test().");
+        kshell_add_command("namebench", namev_bench, "Time path resolution at depths 1 to 16.");
+#ifdef __PIPES__
+        kshell_add_command("pipetest", pipe_test, "Write through a pipe and read it back.");
+#endif
         dbg(DBG_PRINT, "(GRADING2B)\n");
 #endif /* __VFS__ */
 
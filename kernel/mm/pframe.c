@@ -90,6 +90,19 @@ static slab_allocator_t *pframe_allocator;
 #define hash_page(obj, pagenum) ((((uint32_t)(obj)) + (pagenum)) % PF_HASH_SIZE)
 static list_t pframe_hash[PF_HASH_SIZE];
 
+/*     The WRITEBACK queue: */
+/*       Ranges of objects pageoutd is to clean on behalf of
+ *       msync(MS_ASYNC), oldest first. Each holds a reference to its object.
+ */
+typedef struct pframe_wb
+{
+        mmobj_t *wb_obj;
+        uint32_t wb_lopage;
+        uint32_t wb_npages;
+        list_link_t wb_link;
+} pframe_wb_t;
+static list_t writeback_list;
+
 /* Related to the Pageout daemon: */
 
 static uint32_t nfreepages_min = 0;
@@ -106,6 +119,7 @@ static ktqueue_t alloc_waitq;
 /* Pageout daemon functions */
 static void *pageoutd_run(int arg1, void *arg2);
 static void pageoutd_exit(void);
+static void pageoutd_writeback(void);
 #define pageoutd_wakeup() (sched_broadcast_on(&pageoutd_waitq))
 #define pageoutd_needed() \
         ((page_free_count() <= nfreepages_min) && (!list_empty(&alloc_list)))
@@ -124,6 +138,7 @@ void pframe_init(void)
         list_init(&pinned_list);
         nallocated = 0;
         list_init(&alloc_list);
+        list_init(&writeback_list);
 
         pframe_allocator = slab_allocator_create("pframe", sizeof(pframe_t));
         KASSERT(NULL != pframe_allocator);
@@ -496,6 +511,9 @@ void pframe_unpin(pframe_t *pf)
 
                 // Increase the number of allocated pages
                 nallocated++;
+
+                /* pframe_clean_range() may be waiting to write the page */
+                sched_broadcast_on(&pf->pf_waitq);
                 dbg(DBG_PRINT, "(GRADING3A)\n");
         }
         dbg(DBG_PRINT, "(GRADING3A)\n");
@@ -653,6 +671,125 @@ list_start:
         dbg(DBG_PFRAME, "pframe_clean_all: completed!\n");
 }
 
+/*
+ * Clean the dirty pages of one object numbered in [lopage, lopage +
+ * npages), in page order, so that a file can be made durable without
+ * writing out everyone else's data. The dirty pages are noted first and
+ * then looked up again one at a time, as cleaning blocks and the pages
+ * may change meanwhile; pages dirtied after the call began are not waited
+ * for. A pinned page may still be being written into (by I/O straight to
+ * user memory), so it is waited for until it is unpinned; with wait 0
+ * (pageoutd, which must not stall on it) it is left for a later pass.
+ *
+ * This routine can block at the mmobj operation level.
+ * @param o the object whose pages to clean
+ * @param lopage the first page of the range
+ * @param npages the number of pages in the range
+ * @param wait whether to wait for pinned pages
+ * @return 0 on success, or the first -errno a page failed with
+ */
+static int
+pframe_clean_pages(mmobj_t *o, uint32_t lopage, uint32_t npages, int wait)
+{
+        uint32_t *pagenums;
+        uint32_t pagenum;
+        pframe_t *pf;
+        int ndirty = 0;
+        int ret = 0;
+        int err, i, j;
+
+        if (0 == o->mmo_nrespages)
+        {
+                return 0;
+        }
+        if (NULL == (pagenums = (uint32_t *)kmalloc(o->mmo_nrespages * sizeof(uint32_t))))
+        {
+                return -ENOMEM;
+        }
+
+        /* note the dirty pages, sorted by page number */
+        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink)
+        {
+                if ((pframe_is_dirty(pf) || pframe_is_busy(pf)) &&
+                    pf->pf_pagenum - lopage < npages)
+                {
+                        for (i = ndirty; i > 0 && pagenums[i - 1] > pf->pf_pagenum; i--)
+                        {
+                                pagenums[i] = pagenums[i - 1];
+                        }
+                        pagenums[i] = pf->pf_pagenum;
+                        ndirty++;
+                }
+        }
+        list_iterate_end();
+
+        dbg(DBG_PFRAME, "cleaning %d pages of obj %p\n", ndirty, o);
+        for (j = 0; j < ndirty; j++)
+        {
+                pagenum = pagenums[j];
+                /* a busy page may be being cleaned already; wait and look again */
+                while (NULL != (pf = pframe_get_resident(o, pagenum)) &&
+                       (pframe_is_busy(pf) ||
+                        (wait && pframe_is_dirty(pf) && pframe_is_pinned(pf))))
+                {
+                        sched_sleep_on(&pf->pf_waitq);
+                }
+                if (NULL == pf || !pframe_is_dirty(pf) || pframe_is_pinned(pf))
+                {
+                        continue;
+                }
+                if ((err = pframe_clean(pf)) < 0 && 0 == ret)
+                {
+                        ret = err;
+                }
+        }
+
+        kfree(pagenums);
+        return ret;
+}
+
+/*
+ * Clean the dirty pages of o numbered in [lopage, lopage + npages) and
+ * wait for them, pinned ones included (see pframe_clean_pages()). This is
+ * called by msync(MS_SYNC), and by fsync(2) through pframe_clean_obj().
+ */
+int pframe_clean_range(mmobj_t *o, uint32_t lopage, uint32_t npages)
+{
+        return pframe_clean_pages(o, lopage, npages, 1);
+}
+
+/*
+ * Clean all of one object's dirty pages (see pframe_clean_range()). This
+ * is called by fsync(2).
+ */
+int pframe_clean_obj(mmobj_t *o)
+{
+        return pframe_clean_range(o, 0, (uint32_t) -1);
+}
+
+/*
+ * Have pageoutd clean the dirty pages of o numbered in [lopage, lopage +
+ * npages) soon, without waiting for it. This is called by
+ * msync(MS_ASYNC).
+ * @return 0, or -ENOMEM if the request could not be queued
+ */
+int pframe_clean_async(mmobj_t *o, uint32_t lopage, uint32_t npages)
+{
+        pframe_wb_t *wb;
+
+        if (NULL == (wb = (pframe_wb_t *)kmalloc(sizeof(pframe_wb_t))))
+        {
+                return -ENOMEM;
+        }
+        o->mmo_ops->ref(o);
+        wb->wb_obj = o;
+        wb->wb_lopage = lopage;
+        wb->wb_npages = npages;
+        list_insert_tail(&writeback_list, &wb->wb_link);
+        pageoutd_wakeup();
+        return 0;
+}
+
 /* Remove a page frame from the page tables of all processes that map it
  * To do that, traverse all processes that map the given page frame into
  * their address space, and zero the corresponding address entry.
@@ -714,6 +851,25 @@ pageoutd_exit()
         pageoutd_thr = NULL;
 }
 
+/*
+ * Cleans the ranges queued by pframe_clean_async() and lets go of their
+ * objects.
+ */
+static void
+pageoutd_writeback(void)
+{
+        pframe_wb_t *wb;
+
+        while (!list_empty(&writeback_list))
+        {
+                wb = list_head(&writeback_list, pframe_wb_t, wb_link);
+                list_remove(&wb->wb_link);
+                pframe_clean_pages(wb->wb_obj, wb->wb_lopage, wb->wb_npages, 0);
+                wb->wb_obj->mmo_ops->put(wb->wb_obj);
+                kfree(wb);
+        }
+}
+
 /*
  * The pageout daemon, when run, gets the least-recently-requested page from the
  * list of pages which are available to be paged out. Make sure to check if the
@@ -728,6 +884,7 @@ pageoutd_run(int arg1, void *arg2)
         while (1)
         {
                 KASSERT(nallocated >= 0);
+                pageoutd_writeback();
                 while ((!pageoutd_target_met()) && (!list_empty(&alloc_list)))
                 {
                         pframe_t *pf;
@@ -761,7 +918,10 @@ pageoutd_run(int arg1, void *arg2)
                                 "page_free_count=|%d|\n",
                     nfreepages_target, nfreepages_min, page_free_count());
                 if (sched_cancellable_sleep_on(&pageoutd_waitq))
+                {
+                        pageoutd_writeback();
                         kthread_exit((void *)0);
+                }
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: Waking up\n");
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: "
                                 "nfreepages_target=|%d| "
@@ -21,6 +21,7 @@
 
 #include "vm/shadow.h"
 #include "vm/vmmap.h"
+#include "vm/vdso.h"
 
 #include "api/exec.h"
 
@@ -155,6 +156,14 @@ int do_fork(struct regs *regs)
     KASSERT(newthr->kt_kstack != NULL);
     dbg(DBG_PRINT, "(GRADING3A 7.a)\n");
 
+    if (vdso_fork(newproc, newthr) < 0)
+    {
+        kthread_destroy(newthr);
+        proc_destroy(newproc);
+        dbg(DBG_PRINT, "(GRADING3D 2)\n");
+        return -ENOMEM;
+    }
+
     setup_process_context(newthr, newproc, regs);
 
     copy_parent_files(newproc);
@@ -20,11 +20,13 @@
 #include "mm/mman.h"
 
 #include "vm/vmmap.h"
+#include "vm/vdso.h"
 
 #include "fs/vfs.h"
 #include "fs/vfs_syscall.h"
 #include "fs/vnode.h"
 #include "fs/file.h"
+#include "fs/aio.h"
 
 proc_t *curproc = NULL; /* global */
 static slab_allocator_t *proc_allocator = NULL;
@@ -316,6 +318,44 @@ proc_create(char *name)
         return res_proc;
 }
 
+/*
+ * Undoes proc_create() for a child of the current process that never
+ * ran, such as one whose fork failed part way. Its thread must already
+ * be gone. Whatever address space and files it was given go with it.
+ */
+void proc_destroy(proc_t *p)
+{
+        KASSERT(curproc == p->p_pproc);
+        KASSERT(list_empty(&p->p_threads));
+
+#ifdef __VFS__
+        if (p->p_cwd != NULL)
+        {
+                vput(p->p_cwd);
+        }
+        for (int a = 0; a < NFILES; a++)
+        {
+                if (NULL != p->p_files[a])
+                {
+                        fput(p->p_files[a]);
+                }
+        }
+#endif /* VFS */
+
+#ifdef __VM__
+        vdso_exit(p);
+        if (NULL != p->p_vmmap)
+        {
+                vmmap_destroy(p->p_vmmap);
+        }
+#endif /* VM */
+
+        list_remove(&p->p_list_link);
+        list_remove(&p->p_child_link);
+        pt_destroy_pagedir(p->p_pagedir);
+        slab_obj_free(proc_allocator, p);
+}
+
 /**
  * Cleans up as much as the process as can be done from within the
  * process. This involves:
@@ -364,6 +404,9 @@ void proc_cleanup(int status)
                 list_iterate_end();
         }
 #ifdef __VFS__
+        /* aiod may still be using our files and pages */
+        aio_exit(curproc);
+
         if (curproc->p_cwd != NULL)
         {
                 vput(curproc->p_cwd);
@@ -380,6 +423,7 @@ void proc_cleanup(int status)
 #endif /* VFS */
 
 #ifdef __VM__
+        vdso_exit(curproc);
         vmmap_destroy(curproc->p_vmmap);
 #endif /* VM */
 
@@ -0,0 +1,100 @@
+#include "kernel.h"
+#include "globals.h"
+#include "types.h"
+
+#include "main/interrupt.h"
+#include "main/apic.h"
+
+#include "proc/timer.h"
+
+#include "vm/vdso.h"
+
+#include "util/init.h"
+#include "util/list.h"
+#include "util/debug.h"
+
+/*
+ * The kernel clock. The APIC timer interrupts HZ times a second and
+ * jiffies counts those ticks since boot. Timers are kept sorted by the
+ * tick they expire at; their functions are called from the interrupt
+ * handler and so must not block.
+ */
+
+volatile uint32_t jiffies = 0;
+
+static list_t timer_list;
+
+static void timer_intr(regs_t *regs)
+{
+        ktimer_t *tm;
+
+        jiffies++;
+        vdso_tick(jiffies);
+        while (!list_empty(&timer_list))
+        {
+                tm = list_head(&timer_list, ktimer_t, tm_link);
+                if ((int32_t)(tm->tm_expires - jiffies) > 0)
+                {
+                        break;
+                }
+                list_remove(&tm->tm_link);
+                tm->tm_func(tm->tm_arg);
+        }
+}
+
+static __attribute__((unused)) void timer_init(void)
+{
+        list_init(&timer_list);
+        intr_register(INTR_APICTIMER, timer_intr);
+        apic_enable_periodic_timer(HZ);
+}
+init_func(timer_init);
+
+void ktimer_init(ktimer_t *tm, void (*func)(void *), void *arg)
+{
+        tm->tm_expires = 0;
+        tm->tm_func = func;
+        tm->tm_arg = arg;
+        list_link_init(&tm->tm_link);
+}
+
+/* Arms tm to go off ticks ticks from now. */
+void ktimer_add(ktimer_t *tm, uint32_t ticks)
+{
+        uint8_t oldipl = intr_getipl();
+        ktimer_t *next;
+
+        KASSERT(!list_link_is_linked(&tm->tm_link));
+        intr_setipl(IPL_HIGH);
+        tm->tm_expires = jiffies + MAX(ticks, 1);
+        list_iterate_begin(&timer_list, next, ktimer_t, tm_link)
+        {
+                if ((int32_t)(next->tm_expires - tm->tm_expires) > 0)
+                {
+                        list_insert_before(&next->tm_link, &tm->tm_link);
+                        intr_setipl(oldipl);
+                        return;
+                }
+        }
+        list_iterate_end();
+        list_insert_tail(&timer_list, &tm->tm_link);
+        intr_setipl(oldipl);
+}
+
+/* Disarms tm if it has not gone off yet. */
+void ktimer_del(ktimer_t *tm)
+{
+        uint8_t oldipl = intr_getipl();
+
+        intr_setipl(IPL_HIGH);
+        if (list_link_is_linked(&tm->tm_link))
+        {
+                list_remove(&tm->tm_link);
+        }
+        intr_setipl(oldipl);
+}
+
+uint32_t ms_to_jiffies(uint32_t ms)
+{
+        return (ms + (1000 / HZ) - 1) / (1000 / HZ);
+}
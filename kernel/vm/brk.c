@@ -5,6 +5,7 @@
 #include "mm/mm.h"
 #include "mm/page.h"
 #include "mm/mman.h"
+#include "mm/tlb.h"
 
 #include "vm/mmap.h"
 #include "vm/vmmap.h"
@@ -65,18 +66,25 @@ static int validate_brk_addr(void *addr) {
 
 // Helper function to handle break expansion
 static int expand_brk(vmarea_t *vma, uint32_t prev_end, uint32_t cur_end,
-                      uint32_t npages) {
+                      uint32_t npages, int populate) {
     if (!vmmap_is_range_empty(curproc->p_vmmap, prev_end, npages)) {
         dbg(DBG_PRINT, "(GRADING3D 2)\n");
         return -ENOMEM;
     }
     vma->vma_end = cur_end;
+
+    /* do_brk_populate() gets the new pages up front, like a MAP_POPULATE
+     * mapping would. */
+    if (populate) {
+        vmmap_populate(curproc->p_vmmap, prev_end, npages);
+        tlb_flush_range((uintptr_t)PN_TO_ADDR(prev_end), npages);
+        dbg(DBG_PRINT, "(GRADING3A)\n");
+    }
     dbg(DBG_PRINT, "(GRADING3A)\n");
     return 0;
 }
 
-int do_brk(void *addr, void **ret) {
-        // NOT_YET_IMPLEMENTED("VM: do_brk");
+static int brk_set(void *addr, int populate, void **ret) {
     int err;
     vmarea_t *vma;
     uint32_t prev_end;
@@ -96,12 +104,14 @@ int do_brk(void *addr, void **ret) {
 
     vma = vmmap_lookup(curproc->p_vmmap, ADDR_TO_PN(curproc->p_start_brk));
 
-    prev_end = vma->vma_end;
+    /* The heap area may have been merged with an adjacent anonymous
+     * mapping, so its end is not necessarily the end of the heap. */
+    prev_end = ADDR_TO_PN(PAGE_ALIGN_UP(curproc->p_brk));
     cur_end = ADDR_TO_PN(PAGE_ALIGN_UP(addr));
     num_pages = cur_end - prev_end;
 
     if (prev_end < cur_end) {
-        if ((err = expand_brk(vma, prev_end, cur_end, num_pages)) < 0) {
+        if ((err = expand_brk(vma, prev_end, cur_end, num_pages, populate)) < 0) {
             dbg(DBG_PRINT, "(GRADING3D 2)\n");
             return err;
         }
@@ -116,3 +126,16 @@ int do_brk(void *addr, void **ret) {
     return 0;
 }
 
+int do_brk(void *addr, void **ret) {
+        // NOT_YET_IMPLEMENTED("VM: do_brk");
+    return brk_set(addr, 0, ret);
+}
+
+/*
+ * Like do_brk(), but any pages the heap grows by are brought in and
+ * mapped right away (see vmmap_populate()), for a caller that is about to
+ * touch all of them. Failing to populate is not an error.
+ */
+int do_brk_populate(void *addr, void **ret) {
+    return brk_set(addr, 1, ret);
+}
@@ -19,6 +19,8 @@
 #include "vm/vmmap.h"
 #include "vm/mmap.h"
 
+#include "api/access.h"
+
 // Helper function for argument validation
 static int validate_mmap_args(void *addr, size_t len, int prot, int flags,
                               off_t off)
@@ -116,6 +118,31 @@ err = handle_file_related_tasks(fd, flags, prot, &file, &vn);
 
     npages = len / PAGE_SIZE + ((len % PAGE_SIZE != 0) ? 1 : 0);
 
+    /* A shared view of a file opened without write access must never
+     * become writable; the area remembers that for vmmap_protect(). */
+    if (file != NULL && (flags & MAP_SHARED) && !(file->f_mode & FMODE_WRITE))
+    {
+        flags |= MAP_NOWRITE;
+    }
+
+    /* Pick the range up front: the area vmmap_map() hands back may have
+     * been merged into a neighbor and so does not tell us where the
+     * new mapping starts. */
+    if (lopage == 0)
+    {
+        int range = vmmap_find_range(curproc->p_vmmap, npages, VMMAP_DIR_HILO);
+        if (range < 0)
+        {
+            if (file != NULL)
+            {
+                fput(file);
+            }
+            dbg(DBG_PRINT, "(GRADING3D 2)\n");
+            return -ENOMEM;
+        }
+        lopage = range;
+    }
+
     if ((err = vmmap_map(curproc->p_vmmap, vn, lopage, npages, prot, flags, off,
                          VMMAP_DIR_HILO, &new)) < 0)
     {
@@ -138,7 +165,14 @@ err = handle_file_related_tasks(fd, flags, prot, &file, &vn);
         fput(file);
         dbg(DBG_PRINT, "(GRADING3A)\n");
     }
-    *ret = PN_TO_ADDR(new->vma_start);
+    *ret = PN_TO_ADDR(lopage);
+
+    /* Failing to populate is not an error; the rest faults in as usual. */
+    if (flags & MAP_POPULATE)
+    {
+        vmmap_populate(curproc->p_vmmap, lopage, npages);
+        dbg(DBG_PRINT, "(GRADING3A)\n");
+    }
 
     tlb_flush_all();
 
@@ -211,3 +245,208 @@ int do_munmap(void *addr, size_t len)
     dbg(DBG_PRINT, "(GRADING3D 2)\n");
     return 0;
 }
+
+/*
+ * This function implements the mprotect(2) syscall.
+ *
+ * The range must be page aligned and fully mapped, and PROT_WRITE is
+ * refused with EACCES on shared mappings of files opened read-only, as
+ * mmap() does; vmmap_protect() does the splitting and page table work,
+ * after which only the affected range of the TLB is flushed.
+ */
+int do_mprotect(void *addr, size_t len, int prot)
+{
+    uint32_t npages;
+    int err;
+
+    if (!PAGE_ALIGNED(addr) || len == 0 ||
+        (uint32_t)addr < USER_MEM_LOW || (uint32_t)addr + len < (uint32_t)addr ||
+        (uint32_t)addr + len > USER_MEM_HIGH)
+    {
+        dbg(DBG_PRINT, "(GRADING3D 5)\n");
+        return -EINVAL;
+    }
+    if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))
+    {
+        dbg(DBG_PRINT, "(GRADING3D 5)\n");
+        return -EINVAL;
+    }
+
+    npages = ADDR_TO_PN(PAGE_ALIGN_UP((uint32_t)addr + len)) - ADDR_TO_PN(addr);
+    if ((err = vmmap_protect(curproc->p_vmmap, ADDR_TO_PN(addr), npages, prot)) < 0)
+    {
+        dbg(DBG_PRINT, "(GRADING3D 2)\n");
+        return err;
+    }
+
+    tlb_flush_range((uintptr_t)addr, npages);
+    dbg(DBG_PRINT, "(GRADING3D 2)\n");
+    return 0;
+}
+
+/*
+ * This function implements the mremap(2) syscall.
+ *
+ * Resizes the mapping at old_addr, moving it if it cannot grow in place
+ * and MREMAP_MAYMOVE is given (see vmmap_remap()). A moved mapping takes
+ * its pages along by page table updates only. The new start address is
+ * stored in *ret.
+ */
+int do_mremap(void *old_addr, size_t old_len, size_t new_len, int flags,
+              void **ret)
+{
+    uint32_t lopage, oldpages, newpages, newlopage;
+    int err;
+
+    if (!PAGE_ALIGNED(old_addr) || old_len == 0 || new_len == 0 ||
+        (flags & ~MREMAP_MAYMOVE))
+    {
+        dbg(DBG_PRINT, "(GRADING3D 5)\n");
+        return -EINVAL;
+    }
+    if ((uint32_t)old_addr < USER_MEM_LOW ||
+        (uint32_t)old_addr + old_len > USER_MEM_HIGH ||
+        new_len > USER_MEM_HIGH - USER_MEM_LOW)
+    {
+        dbg(DBG_PRINT, "(GRADING3D 5)\n");
+        return -EINVAL;
+    }
+
+    lopage = ADDR_TO_PN(old_addr);
+    oldpages = ADDR_TO_PN(PAGE_ALIGN_UP(old_len));
+    newpages = ADDR_TO_PN(PAGE_ALIGN_UP(new_len));
+
+    err = vmmap_remap(curproc->p_vmmap, lopage, oldpages, newpages,
+                      flags & MREMAP_MAYMOVE, &newlopage);
+    if (err < 0)
+    {
+        dbg(DBG_PRINT, "(GRADING3D 2)\n");
+        return err;
+    }
+
+    tlb_flush_range((uintptr_t)old_addr, oldpages);
+    if (newlopage != lopage)
+    {
+        tlb_flush_range((uintptr_t)PN_TO_ADDR(newlopage), newpages);
+    }
+    *ret = PN_TO_ADDR(newlopage);
+    dbg(DBG_PRINT, "(GRADING3D 2)\n");
+    return 0;
+}
+
+/*
+ * This function implements the madvise(2) syscall.
+ *
+ * Validates the range and advice and lets vmmap_advise() act on it. The
+ * range is flushed from the TLB afterwards since advice which discards
+ * pages takes them out of the page table.
+ */
+int do_madvise(void *addr, size_t len, int advice)
+{
+    uint32_t npages;
+    int err;
+
+    if (!PAGE_ALIGNED(addr) || len == 0 ||
+        (uint32_t)addr < USER_MEM_LOW || (uint32_t)addr + len > USER_MEM_HIGH)
+    {
+        dbg(DBG_PRINT, "(GRADING3D 5)\n");
+        return -EINVAL;
+    }
+    switch (advice)
+    {
+        case MADV_NORMAL:
+        case MADV_SEQUENTIAL:
+        case MADV_RANDOM:
+        case MADV_WILLNEED:
+        case MADV_DONTNEED:
+        case MADV_FREE:
+            break;
+        default:
+            dbg(DBG_PRINT, "(GRADING3D 5)\n");
+            return -EINVAL;
+    }
+
+    npages = ADDR_TO_PN(PAGE_ALIGN_UP((uint32_t)addr + len)) - ADDR_TO_PN(addr);
+    err = vmmap_advise(curproc->p_vmmap, ADDR_TO_PN(addr), npages, advice);
+    tlb_flush_range((uintptr_t)addr, npages);
+    dbg(DBG_PRINT, "(GRADING3D 2)\n");
+    return err;
+}
+
+/* pages of residency reported per copy out to userland */
+#define MINCORE_CHUNK 128
+
+/*
+ * This function implements the mincore(2) syscall.
+ *
+ * Stores one byte per page of [addr, addr + len) into the user array vec,
+ * 1 if the page is resident and 0 otherwise (see vmmap_mincore()). The
+ * answer is built in a small kernel buffer and copied out a chunk at a
+ * time.
+ */
+int do_mincore(void *addr, size_t len, unsigned char *vec)
+{
+    unsigned char buf[MINCORE_CHUNK];
+    uint32_t lopage, npages, n;
+    int err;
+
+    if (!PAGE_ALIGNED(addr) || len == 0 ||
+        (uint32_t)addr < USER_MEM_LOW || (uint32_t)addr + len > USER_MEM_HIGH)
+    {
+        dbg(DBG_PRINT, "(GRADING3D 5)\n");
+        return -EINVAL;
+    }
+
+    lopage = ADDR_TO_PN(addr);
+    npages = ADDR_TO_PN(PAGE_ALIGN_UP((uint32_t)addr + len)) - lopage;
+    while (npages > 0)
+    {
+        n = MIN(npages, MINCORE_CHUNK);
+        if ((err = vmmap_mincore(curproc->p_vmmap, lopage, n, buf)) < 0 ||
+            (err = copy_to_user(vec, buf, n)) < 0)
+        {
+            dbg(DBG_PRINT, "(GRADING3D 2)\n");
+            return err;
+        }
+        lopage += n;
+        npages -= n;
+        vec += n;
+    }
+    dbg(DBG_PRINT, "(GRADING3D 2)\n");
+    return 0;
+}
+
+/*
+ * This function implements the msync(2) syscall.
+ *
+ * Writes the dirty pages of the shared file mappings in the range back
+ * to their files, waiting for them with MS_SYNC or leaving it to
+ * pageoutd with MS_ASYNC (see vmmap_sync()). Exactly one of the two must
+ * be given. MS_INVALIDATE is accepted and does nothing more, since a
+ * file's pages are shared by all its mappings and reads.
+ */
+int do_msync(void *addr, size_t len, int flags)
+{
+    uint32_t npages;
+
+    if (!PAGE_ALIGNED(addr) || (uint32_t)addr < USER_MEM_LOW ||
+        (uint32_t)addr + len > USER_MEM_HIGH || (uint32_t)addr + len < (uint32_t)addr)
+    {
+        dbg(DBG_PRINT, "(GRADING3D 5)\n");
+        return -EINVAL;
+    }
+    if ((flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) ||
+        !(flags & MS_ASYNC) == !(flags & MS_SYNC))
+    {
+        dbg(DBG_PRINT, "(GRADING3D 5)\n");
+        return -EINVAL;
+    }
+
+    npages = ADDR_TO_PN(PAGE_ALIGN_UP((uint32_t)addr + len)) - ADDR_TO_PN(addr);
+    if (0 == npages)
+    {
+        return 0;
+    }
+    dbg(DBG_PRINT, "(GRADING3D 2)\n");
+    return vmmap_sync(curproc->p_vmmap, ADDR_TO_PN(addr), npages, flags);
+}
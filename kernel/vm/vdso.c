@@ -0,0 +1,247 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "main/interrupt.h"
+
+#include "util/init.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/debug.h"
+
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/timer.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/kmalloc.h"
+
+#include "vm/vmmap.h"
+#include "vm/vdso.h"
+
+/*
+ * Values user space can read without a trap. Every process gets two
+ * shared anonymous pages, mapped at exec (and on first use by a process
+ * that was never exec'ed): a read-only vdso_page_t holding its pid and a
+ * clock the timer interrupt keeps up to date, and a writable page holding
+ * its thread's errno. The kernel keeps both pages pinned and works on
+ * them through their kernel addresses; the errno page is loaded into
+ * kt_errno on every trap and stored back on the way out, so it always
+ * agrees with SYS_errno/SYS_set_errno.
+ *
+ * The mapping is shared so that fork does not put the parent's pages
+ * behind a shadow object; the child gets fresh pages at the same address
+ * instead.
+ */
+
+#define VDSO_NPAGES     2
+#define VDSO_DATA       0
+#define VDSO_ERRNO      1
+
+typedef struct vdso {
+        proc_t         *vd_proc;
+        uint32_t        vd_lopage;
+        pframe_t       *vd_pfs[VDSO_NPAGES];
+        list_link_t     vd_link;        /* on vdso_list */
+} vdso_t;
+
+#define VDSO_PAGE(vd)  ((vdso_page_t *)(vd)->vd_pfs[VDSO_DATA]->pf_addr)
+#define VDSO_ERRNOP(vd) ((int *)(vd)->vd_pfs[VDSO_ERRNO]->pf_addr)
+
+static list_t vdso_list;
+
+static __attribute__((unused)) void vdso_init(void)
+{
+        list_init(&vdso_list);
+}
+init_func(vdso_init);
+
+/*
+ * Maps the pages into p at lopage (anywhere if lopage is 0), points thr's
+ * errno at them and fills them in.
+ */
+static int vdso_map(proc_t *p, kthread_t *thr, uint32_t lopage)
+{
+        vdso_t *vd;
+        vmarea_t *vma;
+        uint8_t oldipl;
+        int range, err, i;
+
+        if (NULL == (vd = (vdso_t *)kmalloc(sizeof(vdso_t))))
+        {
+                return -ENOMEM;
+        }
+        if (0 == lopage)
+        {
+                if ((range = vmmap_find_range(p->p_vmmap, VDSO_NPAGES, VMMAP_DIR_HILO)) < 0)
+                {
+                        kfree(vd);
+                        return -ENOMEM;
+                }
+                lopage = range;
+        }
+        if ((err = vmmap_map(p->p_vmmap, NULL, lopage, VDSO_NPAGES, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANON, 0, VMMAP_DIR_HILO, &vma)) < 0)
+        {
+                kfree(vd);
+                return err;
+        }
+        if ((err = vmmap_pin_pages(p->p_vmmap, lopage, VDSO_NPAGES, 1, vd->vd_pfs)) < 0)
+        {
+                vmmap_remove(p->p_vmmap, lopage, VDSO_NPAGES);
+                kfree(vd);
+                return err;
+        }
+        for (i = 0; i < VDSO_NPAGES; i++)
+        {
+                vd->vd_pfs[i]->pf_obj->mmo_ops->ref(vd->vd_pfs[i]->pf_obj);
+        }
+        vmmap_protect(p->p_vmmap, lopage + VDSO_DATA, 1, PROT_READ);
+
+        vd->vd_proc = p;
+        vd->vd_lopage = lopage;
+        VDSO_PAGE(vd)->vp_pid = p->p_pid;
+        VDSO_PAGE(vd)->vp_hz = HZ;
+        VDSO_PAGE(vd)->vp_jiffies = jiffies;
+        *VDSO_ERRNOP(vd) = thr->kt_errno;
+
+        oldipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        list_insert_tail(&vdso_list, &vd->vd_link);
+        intr_setipl(oldipl);
+
+        p->p_vdso = vd;
+        thr->kt_uerrno = VDSO_ERRNOP(vd);
+        return 0;
+}
+
+/* Lets go of p's pages. The mapping itself goes with p's address space. */
+static void vdso_release(proc_t *p)
+{
+        vdso_t *vd = p->p_vdso;
+        kthread_t *thr;
+        uint8_t oldipl;
+        mmobj_t *o;
+        int i;
+
+        if (NULL == vd)
+        {
+                return;
+        }
+
+        oldipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        list_remove(&vd->vd_link);
+        intr_setipl(oldipl);
+
+        list_iterate_begin(&p->p_threads, thr, kthread_t, kt_plink)
+        {
+                thr->kt_uerrno = NULL;
+        }
+        list_iterate_end();
+
+        for (i = 0; i < VDSO_NPAGES; i++)
+        {
+                o = vd->vd_pfs[i]->pf_obj;
+                pframe_unpin(vd->vd_pfs[i]);
+                o->mmo_ops->put(o);
+        }
+        p->p_vdso = NULL;
+        kfree(vd);
+}
+
+/* Called by the timer interrupt on every tick. */
+void vdso_tick(uint32_t now)
+{
+        vdso_t *vd;
+
+        list_iterate_begin(&vdso_list, vd, vdso_t, vd_link)
+        {
+                VDSO_PAGE(vd)->vp_jiffies = now;
+        }
+        list_iterate_end();
+}
+
+/* The current process has a new address space; give it new pages. */
+int vdso_exec(void)
+{
+        vdso_release(curproc);
+        return vdso_map(curproc, curthr, 0);
+}
+
+/*
+ * Whether vd's pages are still mapped at vd_lopage in map. The user may
+ * have unmapped or moved them, and something else may be there now.
+ */
+static int vdso_mapped(vmmap_t *map, vdso_t *vd)
+{
+        vmarea_t *vma;
+        uint32_t vfn;
+        int i;
+
+        for (i = 0; i < VDSO_NPAGES; i++)
+        {
+                vfn = vd->vd_lopage + i;
+                if (NULL == (vma = vmmap_lookup(map, vfn)) ||
+                    vma->vma_obj != vd->vd_pfs[i]->pf_obj ||
+                    vma->vma_off + vfn - vma->vma_start != vd->vd_pfs[i]->pf_pagenum)
+                {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/*
+ * child, with its one thread thr, was just forked from the current
+ * process and shares its pages; give it its own at the same address.
+ * Returns -ENOMEM if there are none to give, in which case the fork has
+ * to fail: the child would find nothing at the address it has cached.
+ */
+int vdso_fork(proc_t *child, kthread_t *thr)
+{
+        vdso_t *vd = curproc->p_vdso;
+
+        child->p_vdso = NULL;
+        thr->kt_uerrno = NULL;
+        if (NULL == vd || !vdso_mapped(child->p_vmmap, vd))
+        {
+                return 0;
+        }
+        vmmap_remove(child->p_vmmap, vd->vd_lopage, VDSO_NPAGES);
+        if (vdso_map(child, thr, vd->vd_lopage) < 0)
+        {
+                dbg(DBG_VM, "vdso: no pages for pid %d\n", child->p_pid);
+                return -ENOMEM;
+        }
+        return 0;
+}
+
+void vdso_exit(proc_t *p)
+{
+        vdso_release(p);
+}
+
+/*
+ * Returns the address of the current process's pages in *ret, mapping
+ * them first if the process has none yet, or none where it had them.
+ */
+int do_vdso(void **ret)
+{
+        int err;
+
+        if (NULL != curproc->p_vdso && !vdso_mapped(curproc->p_vmmap, curproc->p_vdso))
+        {
+                vdso_release(curproc);
+        }
+        if (NULL == curproc->p_vdso && (err = vdso_map(curproc, curthr, 0)) < 0)
+        {
+                return err;
+        }
+        *ret = PN_TO_ADDR(curproc->p_vdso->vd_lopage);
+        return 0;
+}